@@ -1 +1 @@
-make TARGET="$1" && ./build/"$1"
+make TARGET="$1" && "./$(make -s TARGET="$1" print-bin)" "${@:2}"
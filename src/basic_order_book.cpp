@@ -0,0 +1,135 @@
+#include "basic_order_book.hpp"
+#include "order_flow_bench.hpp"
+#include <array>
+#include <iostream>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// one BasicOrderBook, a few venue configurations:
+//
+// - DenseBook: prices in a narrow tick band and dense exchange ids, so a flat
+//   ladder, the direct indexed id window and pooled nodes
+// - SparseBook: prices all over the place and ids that aren't sequential, the
+//   textbook std::map + std::unordered_map + std::list
+// - the two in between, for when only one of those holds
+// - DenseSoaBook: DenseBook with every order field in its own array, Book's
+//   layout in order_book_2.cpp
+//
+// `./build/basic_order_book bench ops=... cancel=...` runs the order flow
+// benchmark (order_flow_bench.hpp) against every configuration
+
+using DenseBook =
+    BasicOrderBook<PooledLevels, FlatIndex, LadderPrices<uint32_t, uint32_t>>;
+using DenseIdsSparsePrices =
+    BasicOrderBook<PooledLevels, FlatIndex, TreePrices<uint64_t>>;
+using SparseIdsDensePrices =
+    BasicOrderBook<ListLevels, HashIndex, LadderPrices<uint64_t>>;
+using SparseBook = BasicOrderBook<ListLevels, HashIndex, TreePrices<uint64_t>>;
+using DenseSoaBook =
+    BasicOrderBook<SoaLevels, FlatIndex, LadderPrices<uint32_t, uint32_t>>;
+
+template <typename B>
+struct BasicBench {
+  B book;
+
+  void add(uint64_t id, bool is_bid, uint64_t price, uint64_t qty) {
+    book.add_order(id, is_bid, static_cast<typename B::Price>(price),
+                   static_cast<typename B::Qty>(qty));
+  }
+  void remove(uint64_t id) { book.delete_order(id); }
+  void modify(uint64_t id, uint64_t price, uint64_t qty) {
+    book.modify_order(id, static_cast<typename B::Price>(price),
+                      static_cast<typename B::Qty>(qty));
+  }
+};
+
+template <typename B>
+int bench(std::string_view name, const BenchConfig& config) {
+  BasicBench<B> adapter{B(config.depth * 2)};
+  auto result = run_bench(name, adapter, config);
+  std::cout << "\n";
+  return result;
+}
+
+// the same script against any configuration, rendered to a string so that
+// they can be compared
+template <typename B>
+std::string script() {
+  B book(16, 1, 64);
+  std::ostringstream out;
+  auto fill = [&out](uint64_t maker, uint64_t taker, auto price, auto qty) {
+    out << "fill " << maker << "/" << taker << " " << price << " x " << qty
+        << "\n";
+  };
+
+  book.add_order(1, true, 100, 10);
+  book.add_order(2, true, 100, 5);
+  book.add_order(3, true, 99, 7);
+  book.add_order(4, false, 105, 3);
+  book.add_order(5, false, 5000, 1); // way outside the ladder window
+  book.modify_order(1, 100, 12);     // grows, goes behind 2
+  book.reduce_order(3, 2);
+  book.add_order(6, false, 99, 20, fill); // sweeps 100 and 99
+  book.modify_order(4, 104, 3);
+  book.modify_order(4, 104, 0); // refused, like Book, 4 stays
+  book.delete_order(5);
+
+  std::array<typename B::LevelSummary, 4> depth{};
+  for (bool is_bid : {true, false}) {
+    auto n = book.top_n(is_bid, depth.size(), depth);
+    for (size_t i = 0; i < n; ++i) {
+      out << (is_bid ? "bid " : "ask ") << depth[i].price << " x "
+          << depth[i].total_qty << " (" << depth[i].num_orders << ")\n";
+    }
+  }
+  out << book << "\n";
+  return out.str();
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 2 && std::string_view(argv[1]) == "bench") {
+    auto config = parse_bench_args(std::span(argv + 2, argv + argc));
+    if (!config) {
+      std::cerr << "usage: basic_order_book bench " << bench_options << "\n";
+      return 1;
+    }
+    // one statement each, so the reports come out in this order
+    int result = bench<DenseBook>("DenseBook", *config);
+    result |= bench<DenseIdsSparsePrices>("DenseIdsSparsePrices", *config);
+    result |= bench<SparseIdsDensePrices>("SparseIdsDensePrices", *config);
+    result |= bench<SparseBook>("SparseBook", *config);
+    result |= bench<DenseSoaBook>("DenseSoaBook", *config);
+    return result;
+  }
+
+  // output:
+  // fill 2/6 100 x 5
+  // fill 1/6 100 x 12
+  // fill 3/6 99 x 3
+  // bid 99 x 2 (1)
+  // ask 104 x 3 (1)
+  // ====================
+  // ask: $104 | { id: 4 , qty: 3 }
+  //
+  // bid: $99 | { id: 3 , qty: 2 }
+  // ====================
+  auto dense = script<DenseBook>();
+  std::cout << dense;
+
+  bool same = dense == script<DenseIdsSparsePrices>() &&
+              dense == script<SparseIdsDensePrices>() &&
+              dense == script<SparseBook>() &&
+              dense == script<DenseSoaBook>();
+  // output: true
+  std::cout << std::boolalpha << same << "\n";
+
+  // node sizes, the point of picking a configuration
+  // output: 16 24
+  std::cout << sizeof(DenseBook::Order) << " "
+            << sizeof(SparseBook::Order) << "\n";
+
+  return 0;
+}
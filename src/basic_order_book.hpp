@@ -0,0 +1,768 @@
+#pragma once
+
+#include "book_side.hpp"
+#include "order_index.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+// the order book, written once. OrderBook (order_book.cpp) and Book
+// (order_book_2.cpp) are both a BasicOrderBook with a different set of
+// policies plugged in, plus whatever they do around it (events and depth
+// publishing, journaling and snapshots):
+//
+// - LevelPolicy: where orders live and how the orders at one price are queued.
+//   ListLevels is a std::list per level. PooledLevels and SoaLevels are the
+//   same intrusive list over 32 bit handles, with the orders stored as nodes
+//   (OrderBook) or as one array per field (Book)
+// - IndexPolicy: the id -> order lookup. FlatIndex (FlatOrderIndex, for dense
+//   increasing ids) or HashIndex (std::unordered_map)
+// - PricePolicy: the price and quantity types, and the side container.
+//   LadderPrices (a dense tick window, BookSide) or TreePrices (std::map,
+//   TreeSide)
+// - MatchPolicy: MatchOnAdd trades an incoming order (or a reprice) against
+//   the other side in price-time priority before resting what's left (Book).
+//   RestOnly rests every order as given, for a book mirroring a venue's feed,
+//   where trades arrive as deletes and modifies (OrderBook)
+// - Hooks: told about every change to a level's aggregates, see NoHooks.
+//   OrderBook turns these into level events and stats, Book into its
+//   DepthIndex
+//
+// everything is resolved at compile time, there are no virtual calls or
+// function pointers anywhere on the path. a same price modify keeps priority
+// when it reduces and loses it when it grows, a modify to zero is refused
+// (cancel with delete_order or reduce_order), reducing by everything that's
+// left deletes, and an add for zero rests nothing
+
+// handles index into a pooled queue's storage, so they stay valid as it grows
+using OrderHandle = uint32_t;
+inline constexpr OrderHandle null_handle =
+    std::numeric_limits<OrderHandle>::max();
+
+// ---- level policies ----
+//
+// a level policy provides Queue<Order>, one per book, with:
+//   List          per level queue state
+//   Handle        how the index finds an order again
+//   max_orders    how many orders fit, full() once that many are live
+//   push_back(list, order) -> Handle, erase(list, handle)
+//   move_to_back(list, handle), front(list) -> Handle (list not empty)
+//   id(handle), price(handle), qty(handle) -> Qty&
+//   for_each(list, f(id, qty)), prefetch(handle), reserve(n)
+
+struct ListLevels {
+  template <typename Order>
+  class Queue {
+  public:
+    using List = std::list<Order>;
+    using Handle = typename List::iterator;
+    static constexpr size_t max_orders = std::numeric_limits<size_t>::max();
+
+    explicit Queue(size_t /*capacity_hint*/) {}
+
+    void reserve(size_t /*n*/) {}
+    [[nodiscard]] bool full() const noexcept { return false; }
+
+    Handle push_back(List& list, const Order& order) {
+      list.push_back(order);
+      return std::prev(list.end());
+    }
+    void erase(List& list, Handle handle) { list.erase(handle); }
+
+    // splice keeps the iterator (and so the index entry) valid
+    void move_to_back(List& list, Handle handle) {
+      list.splice(list.end(), list, handle);
+    }
+
+    [[nodiscard]] Handle front(List& list) { return list.begin(); }
+
+    [[nodiscard]] auto id(Handle handle) const noexcept { return handle->id; }
+    [[nodiscard]] auto price(Handle handle) const noexcept {
+      return handle->price;
+    }
+    [[nodiscard]] auto& qty(Handle handle) const noexcept {
+      return handle->qty;
+    }
+
+    template <typename F>
+    void for_each(const List& list, F&& f) const {
+      for (const auto& order : list)
+        f(order.id, order.qty);
+    }
+
+    void prefetch(Handle handle) const noexcept {
+      __builtin_prefetch(&*handle);
+    }
+  };
+};
+
+// a doubly linked list per level, threaded through 32 bit handles into one
+// Storage for the whole book. freed handles go on a free list (through next)
+// and get reused, so the storage only grows to the peak number of live orders
+// and add/delete/modify don't touch malloc once it has. null_handle can't be
+// an order, which caps a book at max_orders
+//
+// Storage holds the orders and their links: append(order) -> Handle,
+// assign(handle, order), id / price / qty / prev / next (handle) -> field,
+// size(), reserve(n), prefetch(handle)
+template <typename Storage>
+class LinkedQueue {
+public:
+  using Order = typename Storage::Order;
+  using Handle = OrderHandle;
+  static constexpr size_t max_orders = null_handle;
+
+  struct List {
+    Handle head = null_handle;
+    Handle tail = null_handle;
+  };
+
+  explicit LinkedQueue(size_t capacity_hint) { slots.reserve(capacity_hint); }
+
+  void reserve(size_t n) { slots.reserve(n); }
+
+  [[nodiscard]] bool full() const noexcept {
+    return free_head == null_handle && slots.size() == max_orders;
+  }
+
+  Handle push_back(List& list, const Order& order) {
+    Handle handle;
+    if (free_head != null_handle) {
+      handle = free_head;
+      free_head = slots.next(handle);
+      slots.assign(handle, order);
+    } else {
+      handle = slots.append(order);
+    }
+    link_back(list, handle);
+    return handle;
+  }
+
+  void erase(List& list, Handle handle) noexcept {
+    unlink(list, handle);
+    slots.next(handle) = free_head;
+    free_head = handle;
+  }
+
+  // relinked rather than reallocated, so the handle (and the index entry)
+  // stays valid
+  void move_to_back(List& list, Handle handle) noexcept {
+    unlink(list, handle);
+    link_back(list, handle);
+  }
+
+  [[nodiscard]] Handle front(const List& list) const noexcept {
+    return list.head;
+  }
+
+  [[nodiscard]] auto id(Handle handle) const noexcept {
+    return slots.id(handle);
+  }
+  [[nodiscard]] auto price(Handle handle) const noexcept {
+    return slots.price(handle);
+  }
+  [[nodiscard]] auto& qty(Handle handle) noexcept { return slots.qty(handle); }
+  [[nodiscard]] auto qty(Handle handle) const noexcept {
+    return slots.qty(handle);
+  }
+
+  template <typename F>
+  void for_each(const List& list, F&& f) const {
+    for (auto handle = list.head; handle != null_handle;
+         handle = slots.next(handle))
+      f(slots.id(handle), slots.qty(handle));
+  }
+
+  void prefetch(Handle handle) const noexcept { slots.prefetch(handle); }
+
+private:
+  void link_back(List& list, Handle handle) noexcept {
+    slots.prev(handle) = list.tail;
+    slots.next(handle) = null_handle;
+    if (list.tail != null_handle) {
+      slots.next(list.tail) = handle;
+    } else {
+      list.head = handle;
+    }
+    list.tail = handle;
+  }
+
+  void unlink(List& list, Handle handle) noexcept {
+    auto prev = slots.prev(handle);
+    auto next = slots.next(handle);
+    if (prev != null_handle) {
+      slots.next(prev) = next;
+    } else {
+      list.head = next;
+    }
+    if (next != null_handle) {
+      slots.prev(next) = prev;
+    } else {
+      list.tail = prev;
+    }
+  }
+
+  Storage slots;
+  Handle free_head = null_handle;
+};
+
+// the order and its links side by side, one cache line fetch per order
+template <typename O>
+class NodeStorage {
+public:
+  using Order = O;
+
+  void reserve(size_t n) { nodes.reserve(n); }
+  [[nodiscard]] size_t size() const noexcept { return nodes.size(); }
+
+  OrderHandle append(const Order& order) {
+    nodes.push_back(Node{order, null_handle, null_handle});
+    return static_cast<OrderHandle>(nodes.size() - 1);
+  }
+  void assign(OrderHandle handle, const Order& order) noexcept {
+    nodes[handle].order = order;
+  }
+
+  [[nodiscard]] auto id(OrderHandle h) const noexcept {
+    return nodes[h].order.id;
+  }
+  [[nodiscard]] auto price(OrderHandle h) const noexcept {
+    return nodes[h].order.price;
+  }
+  [[nodiscard]] auto& qty(OrderHandle h) noexcept { return nodes[h].order.qty; }
+  [[nodiscard]] auto qty(OrderHandle h) const noexcept {
+    return nodes[h].order.qty;
+  }
+  [[nodiscard]] OrderHandle& prev(OrderHandle h) noexcept {
+    return nodes[h].prev;
+  }
+  [[nodiscard]] OrderHandle prev(OrderHandle h) const noexcept {
+    return nodes[h].prev;
+  }
+  [[nodiscard]] OrderHandle& next(OrderHandle h) noexcept {
+    return nodes[h].next;
+  }
+  [[nodiscard]] OrderHandle next(OrderHandle h) const noexcept {
+    return nodes[h].next;
+  }
+
+  void prefetch(OrderHandle h) const noexcept { __builtin_prefetch(&nodes[h]); }
+
+private:
+  struct Node {
+    Order order;
+    OrderHandle prev;
+    OrderHandle next;
+  };
+
+  std::vector<Node> nodes;
+};
+
+// one array per field, so code that only needs some of the fields only pulls
+// those into cache. walking a level to match touches the qty and link arrays
+// plus the ids of the orders it trades with, never the prices
+template <typename O>
+class ArrayStorage {
+public:
+  using Order = O;
+
+  void reserve(size_t n) {
+    ids.reserve(n);
+    prices.reserve(n);
+    qtys.reserve(n);
+    prevs.reserve(n);
+    nexts.reserve(n);
+  }
+  [[nodiscard]] size_t size() const noexcept { return ids.size(); }
+
+  OrderHandle append(const Order& order) {
+    ids.push_back(order.id);
+    prices.push_back(order.price);
+    qtys.push_back(order.qty);
+    prevs.push_back(null_handle);
+    nexts.push_back(null_handle);
+    return static_cast<OrderHandle>(ids.size() - 1);
+  }
+  void assign(OrderHandle handle, const Order& order) noexcept {
+    ids[handle] = order.id;
+    prices[handle] = order.price;
+    qtys[handle] = order.qty;
+  }
+
+  [[nodiscard]] auto id(OrderHandle h) const noexcept { return ids[h]; }
+  [[nodiscard]] auto price(OrderHandle h) const noexcept { return prices[h]; }
+  [[nodiscard]] auto& qty(OrderHandle h) noexcept { return qtys[h]; }
+  [[nodiscard]] auto qty(OrderHandle h) const noexcept { return qtys[h]; }
+  [[nodiscard]] OrderHandle& prev(OrderHandle h) noexcept { return prevs[h]; }
+  [[nodiscard]] OrderHandle prev(OrderHandle h) const noexcept {
+    return prevs[h];
+  }
+  [[nodiscard]] OrderHandle& next(OrderHandle h) noexcept { return nexts[h]; }
+  [[nodiscard]] OrderHandle next(OrderHandle h) const noexcept {
+    return nexts[h];
+  }
+
+  // what a delete or modify reads first
+  void prefetch(OrderHandle h) const noexcept {
+    __builtin_prefetch(&prices[h]);
+    __builtin_prefetch(&qtys[h]);
+  }
+
+private:
+  std::vector<decltype(Order::id)> ids;
+  std::vector<decltype(Order::price)> prices;
+  std::vector<decltype(Order::qty)> qtys;
+  std::vector<OrderHandle> prevs;
+  std::vector<OrderHandle> nexts;
+};
+
+struct PooledLevels {
+  template <typename Order>
+  using Queue = LinkedQueue<NodeStorage<Order>>;
+};
+
+struct SoaLevels {
+  template <typename Order>
+  using Queue = LinkedQueue<ArrayStorage<Order>>;
+};
+
+// ---- index policies ----
+
+struct FlatIndex {
+  template <typename Value>
+  using Index = FlatOrderIndex<Value>;
+};
+
+struct HashIndex {
+  template <typename Value>
+  using Index = HashOrderIndex<Value>;
+};
+
+// ---- price policies ----
+
+template <typename P, typename Q = uint64_t>
+struct LadderPrices {
+  using Price = P;
+  using Qty = Q;
+  template <Side S, typename Level>
+  using SideBook = BookSide<S, P, Level>;
+};
+
+template <typename P, typename Q = uint64_t>
+struct TreePrices {
+  using Price = P;
+  using Qty = Q;
+  template <Side S, typename Level>
+  using SideBook = TreeSide<S, P, Level>;
+};
+
+// ---- match policies ----
+
+struct MatchOnAdd {
+  static constexpr bool matches = true;
+};
+
+struct RestOnly {
+  static constexpr bool matches = false;
+};
+
+// ---- hooks ----
+
+// called after anything changes a level's aggregates: an order resting,
+// leaving, trading or changing quantity. before is the level's total quantity
+// until now (0 for a new level), and num_orders 0 means the level is about to
+// be erased. a reprice is two calls, one per level
+//
+// hooks are constructed from (tick, num_ticks), so they can size themselves
+// like the ladders, and in place, so they needn't be movable
+struct NoHooks {
+  NoHooks() = default;
+  template <typename Price>
+  NoHooks(Price /*tick*/, size_t /*num_ticks*/) noexcept {}
+
+  template <Side S, typename Price>
+  void level_changed(Price /*price*/, uint64_t /*before*/,
+                     uint64_t /*total_qty*/,
+                     uint32_t /*num_orders*/) noexcept {}
+};
+
+// default for add_order / modify_order when the caller doesn't want fills
+struct IgnoreFills {
+  template <typename... Args>
+  void operator()(const Args&... /*args*/) const noexcept {}
+};
+
+// one row of an L2 (market by price) snapshot
+template <typename Price>
+struct BasicLevelSummary {
+  Price price;
+  uint64_t total_qty;
+  uint32_t num_orders;
+};
+
+// up to n levels of one side from the best price outwards, from any side
+// container whose levels carry total_qty and num_orders. returns the number
+// written
+template <typename SideT, typename Summary>
+size_t top_levels(const SideT& side, size_t n, std::span<Summary> out) {
+  n = std::min(n, out.size());
+  size_t count = 0;
+  for (auto price = side.best(); price && count < n;
+       price = side.next_worse(*price)) {
+    const auto& level = *side.find(*price);
+    out[count++] = Summary{.price = *price,
+                           .total_qty = level.total_qty,
+                           .num_orders = level.num_orders};
+  }
+  return count;
+}
+
+template <typename LevelPolicy, typename IndexPolicy, typename PricePolicy,
+          typename MatchPolicy = MatchOnAdd, typename Hooks = NoHooks>
+class BasicOrderBook {
+public:
+  using OrderId = uint64_t;
+  using Price = typename PricePolicy::Price;
+  using Qty = typename PricePolicy::Qty;
+  using LevelSummary = BasicLevelSummary<Price>;
+
+  struct Order {
+    OrderId id;
+    Price price;
+    Qty qty;
+  };
+
+private:
+  using Queue = typename LevelPolicy::template Queue<Order>;
+  using Handle = typename Queue::Handle;
+
+public:
+  static constexpr size_t max_orders = Queue::max_orders;
+
+  // tick and num_ticks only matter to LadderPrices (and hooks that want them)
+  explicit BasicOrderBook(size_t capacity_hint = 1024, Price tick = 1,
+                          size_t num_ticks = 4096)
+      : queue(capacity_hint), bids(tick, num_ticks), asks(tick, num_ticks),
+        orders(capacity_hint), hook(tick, num_ticks) {}
+
+  // with MatchOnAdd, trades against the other side first, calling
+  // on_fill(maker id, taker id, price, qty) for each fill, then rests what's
+  // left. false for a duplicate id, or once max_orders are resting (even if
+  // the order would have filled without resting)
+  template <typename OnFill = IgnoreFills>
+  bool add_order(OrderId id, bool is_bid, Price price, Qty qty,
+                 OnFill&& on_fill = {}) {
+    if (orders.contains(id) || queue.full())
+      return false;
+
+    visit_side(side_of(is_bid), bids, asks, [&](auto& side) {
+      constexpr Side S = std::decay_t<decltype(side)>::side;
+      if constexpr (MatchPolicy::matches)
+        qty = match<S>(id, price, qty, on_fill);
+      rest(side, id, price, qty);
+    });
+    return true;
+  }
+
+  // puts an order at the back of its level without matching, whatever the
+  // MatchPolicy. for rebuilding a book that's known not to cross (a
+  // snapshot), levels in any order and each queue front to back. false as
+  // for add_order
+  bool restore_order(OrderId id, bool is_bid, Price price, Qty qty) {
+    if (orders.contains(id) || queue.full())
+      return false;
+
+    visit_side(side_of(is_bid), bids, asks,
+               [&](auto& side) { rest(side, id, price, qty); });
+    return true;
+  }
+
+  bool delete_order(OrderId id) {
+    auto* ptr = orders.find(id);
+    if (!ptr)
+      return false;
+
+    auto handle = ptr->handle;
+    visit_side(ptr->side, bids, asks,
+               [&](auto& side) { remove(side, handle); });
+    orders.erase(id);
+    return true;
+  }
+
+  // a reprice is a delete + add, and with MatchOnAdd may trade like a new
+  // order
+  template <typename OnFill = IgnoreFills>
+  bool modify_order(OrderId id, Price new_price, Qty new_qty,
+                    OnFill&& on_fill = {}) {
+    auto* ptr = orders.find(id);
+    if (!ptr || new_qty == 0)
+      return false;
+
+    auto [handle, side_id] = *ptr;
+    if (queue.price(handle) != new_price) {
+      delete_order(id);
+      return add_order(id, side_id == Side::Bid, new_price, new_qty, on_fill);
+    }
+
+    auto& qty = queue.qty(handle);
+    if (new_qty == qty)
+      return true;
+    visit_side(side_id, bids, asks, [&](auto& side) {
+      constexpr Side S = std::decay_t<decltype(side)>::side;
+      auto price = queue.price(handle);
+      auto& level = *side.find(price);
+      auto before = level.total_qty;
+      if (new_qty > qty)
+        queue.move_to_back(level.orders, handle);
+      level.total_qty = before - qty + new_qty;
+      qty = new_qty;
+      hook.template level_changed<S>(price, before, level.total_qty,
+                                     level.num_orders);
+    });
+    return true;
+  }
+
+  // partial cancel, keeps priority. reducing by everything that's left
+  // deletes the order
+  bool reduce_order(OrderId id, Qty reduce_by) {
+    auto* ptr = orders.find(id);
+    if (!ptr || reduce_by == 0)
+      return false;
+
+    auto [handle, side_id] = *ptr;
+    auto& qty = queue.qty(handle);
+    if (reduce_by >= qty)
+      return delete_order(id);
+
+    visit_side(side_id, bids, asks, [&](auto& side) {
+      constexpr Side S = std::decay_t<decltype(side)>::side;
+      auto price = queue.price(handle);
+      auto& level = *side.find(price);
+      auto before = level.total_qty;
+      level.total_qty -= reduce_by;
+      qty -= reduce_by;
+      hook.template level_changed<S>(price, before, level.total_qty,
+                                     level.num_orders);
+    });
+    return true;
+  }
+
+  // sized for n resting orders
+  void reserve(size_t n) {
+    queue.reserve(n);
+    orders.reserve(n);
+  }
+
+  [[nodiscard]] std::optional<Price> best_bid() const noexcept {
+    return bids.best();
+  }
+  [[nodiscard]] std::optional<Price> best_ask() const noexcept {
+    return asks.best();
+  }
+
+  // resting orders, and price levels on both sides
+  [[nodiscard]] size_t size() const noexcept { return orders.size(); }
+  [[nodiscard]] size_t num_levels() const noexcept {
+    return bids.size() + asks.size();
+  }
+  [[nodiscard]] bool contains(OrderId id) const noexcept {
+    return orders.contains(id);
+  }
+
+  // up to n levels from the best price outwards. returns the number written
+  size_t top_n(bool is_bid, size_t n, std::span<LevelSummary> out) const {
+    return visit_side(side_of(is_bid), bids, asks, [&](const auto& side) {
+      return top_levels(side, n, out);
+    });
+  }
+
+  // f(LevelSummary) for every level on one side, best first
+  template <typename F>
+  void for_each_level(bool is_bid, F&& f) const {
+    visit_side(side_of(is_bid), bids, asks, [&](const auto& side) {
+      for (auto price = side.best(); price; price = side.next_worse(*price)) {
+        const auto& level = *side.find(*price);
+        f(LevelSummary{.price = *price,
+                       .total_qty = level.total_qty,
+                       .num_orders = level.num_orders});
+      }
+    });
+  }
+
+  // f(id, qty) for every order at one price, front of the queue first
+  template <typename F>
+  void for_each_order(bool is_bid, Price price, F&& f) const {
+    visit_side(side_of(is_bid), bids, asks, [&](const auto& side) {
+      if (const auto* level = side.find(price))
+        queue.for_each(level->orders, f);
+    });
+  }
+
+  // hints for callers that pipeline lookups ahead of the messages they
+  // belong to (OrderBook::apply_batch). none of them change anything, and the
+  // last two do a lookup, so they pay off once prefetch_id's line is in
+  void prefetch_id(OrderId id) const noexcept { orders.prefetch(id); }
+
+  void prefetch_level(bool is_bid, Price price) const noexcept {
+    visit_side(side_of(is_bid), bids, asks,
+               [price](const auto& side) { side.prefetch(price); });
+  }
+
+  void prefetch_order(OrderId id) const noexcept {
+    if (const auto* ptr = orders.find(id))
+      queue.prefetch(ptr->handle);
+  }
+
+  // the level the order rests in, which needs its price
+  void prefetch_order_level(OrderId id) const noexcept {
+    if (const auto* ptr = orders.find(id))
+      prefetch_level(ptr->side == Side::Bid, queue.price(ptr->handle));
+  }
+
+  // index probes a lookup of id takes, for instrumentation
+  [[nodiscard]] uint32_t probe_length(OrderId id) const noexcept {
+    return orders.probe_length(id);
+  }
+
+  [[nodiscard]] Hooks& hooks() noexcept { return hook; }
+  [[nodiscard]] const Hooks& hooks() const noexcept { return hook; }
+
+  friend std::ostream& operator<<(std::ostream& os,
+                                  const BasicOrderBook& book) {
+    os << "====================\n";
+    for (auto price = book.asks.worst(); price;
+         price = book.asks.next_better(*price)) {
+      os << "ask: $" << *price << " | ";
+      book.print_level(os, *book.asks.find(*price));
+      os << "\n";
+    }
+
+    os << "\n";
+
+    for (auto price = book.bids.best(); price;
+         price = book.bids.next_worse(*price)) {
+      os << "bid: $" << *price << " | ";
+      book.print_level(os, *book.bids.find(*price));
+      os << "\n";
+    }
+    os << "====================";
+    return os;
+  }
+
+private:
+  // the aggregates are kept by the book, so every level policy gets them
+  struct Level {
+    typename Queue::List orders{};
+    uint64_t total_qty = 0;
+    uint32_t num_orders = 0;
+
+    [[nodiscard]] bool empty() const noexcept { return num_orders == 0; }
+  };
+
+  struct OrderPtr {
+    Handle handle;
+    Side side;
+  };
+
+  template <Side S>
+  using SideBook = typename PricePolicy::template SideBook<S, Level>;
+
+  template <Side S>
+  SideBook<S>& side_for() noexcept {
+    if constexpr (S == Side::Bid) {
+      return bids;
+    } else {
+      return asks;
+    }
+  }
+
+  template <typename SideT>
+  void rest(SideT& side, OrderId id, Price price, Qty qty) {
+    if (qty == 0)
+      return;
+
+    // a reference: the level holds the head and tail of its queue
+    auto& level = side.emplace(price);
+    auto before = level.total_qty;
+    auto handle = queue.push_back(level.orders, Order{id, price, qty});
+    level.total_qty += qty;
+    ++level.num_orders;
+    orders.insert(id, OrderPtr{handle, SideT::side});
+    hook.template level_changed<SideT::side>(price, before, level.total_qty,
+                                             level.num_orders);
+  }
+
+  template <typename SideT>
+  void remove(SideT& side, Handle handle) {
+    auto price = queue.price(handle);
+    auto& level = *side.find(price);
+    auto before = level.total_qty;
+    level.total_qty -= queue.qty(handle);
+    --level.num_orders;
+    queue.erase(level.orders, handle);
+    hook.template level_changed<SideT::side>(price, before, level.total_qty,
+                                             level.num_orders);
+    if (level.empty())
+      side.erase(price);
+  }
+
+  // walks the opposite side from its best price while an incoming order on
+  // side S crosses, trading against the front of each level. returns the
+  // quantity left over to rest
+  template <Side S, typename OnFill>
+  Qty match(OrderId id, Price price, Qty qty, OnFill& on_fill) {
+    auto& resting = side_for<opposite(S)>();
+    while (qty > 0) {
+      auto best = resting.best();
+      if (!best || !resting.crossed_by(*best, price))
+        break;
+
+      // every order here is at *best, so the walk never reads a price
+      auto& level = *resting.find(*best);
+      auto before = level.total_qty;
+      while (qty > 0 && !level.empty()) {
+        auto handle = queue.front(level.orders);
+        auto& maker_qty = queue.qty(handle);
+        auto traded = std::min(qty, maker_qty);
+        on_fill(queue.id(handle), id, *best, traded);
+
+        qty -= traded;
+        maker_qty -= traded;
+        level.total_qty -= traded;
+        if (maker_qty == 0) {
+          orders.erase(queue.id(handle));
+          --level.num_orders;
+          queue.erase(level.orders, handle);
+        }
+      }
+
+      hook.template level_changed<opposite(S)>(
+          *best, before, level.total_qty, level.num_orders);
+      if (level.empty())
+        resting.erase(*best);
+    }
+    return qty;
+  }
+
+  void print_level(std::ostream& os, const Level& level) const {
+    bool first = true;
+    queue.for_each(level.orders, [&](OrderId id, Qty qty) {
+      if (!first)
+        os << " -> ";
+      first = false;
+      os << "{ id: " << id << " , qty: " << qty << " }";
+    });
+  }
+
+  Queue queue;
+  SideBook<Side::Bid> bids;
+  SideBook<Side::Ask> asks;
+  typename IndexPolicy::template Index<OrderPtr> orders;
+  [[no_unique_address]] Hooks hook;
+};
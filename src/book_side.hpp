@@ -0,0 +1,270 @@
+#pragma once
+
+#include "price_ladder.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+// one side of a book, with the direction baked in at compile time. "best" is
+// the highest price for bids and the lowest for asks, and everything that
+// depends on that (comparisons, iteration order, the cached best price) lives
+// here instead of being an is_bid branch at every call site
+//
+// books still take a runtime side at their public entry points, branch on it
+// exactly once, and run the rest of the operation in code specialised for
+// BookSide<Side::Bid> or BookSide<Side::Ask>
+//
+// TreeSide has the same interface over a std::map, for venues whose prices are
+// too sparse for a dense ladder. FlatSide keeps the levels in sorted vectors,
+// for books that only ever hold a handful of small levels and care about
+// memory more than anything
+
+enum class Side : uint8_t { Bid, Ask };
+
+[[nodiscard]] constexpr Side side_of(bool is_bid) noexcept {
+  return is_bid ? Side::Bid : Side::Ask;
+}
+
+[[nodiscard]] constexpr Side opposite(Side side) noexcept {
+  return side == Side::Bid ? Side::Ask : Side::Bid;
+}
+
+// the price ordering shared by every side container
+template <Side S, typename Price>
+struct SideOrdering {
+  static constexpr Side side = S;
+  static constexpr bool is_bid = S == Side::Bid;
+
+  // true if a is a strictly better price than b on this side
+  [[nodiscard]] static constexpr bool better(Price a, Price b) noexcept {
+    if constexpr (is_bid) {
+      return a > b;
+    } else {
+      return a < b;
+    }
+  }
+
+  // true if an incoming order from the other side, limited at limit, trades
+  // against a level resting on this side at price
+  [[nodiscard]] static constexpr bool crossed_by(Price price,
+                                                 Price limit) noexcept {
+    return !better(limit, price);
+  }
+};
+
+template <Side S, typename Price, typename Level>
+class BookSide : public SideOrdering<S, Price> {
+public:
+  using SideOrdering<S, Price>::better;
+  using SideOrdering<S, Price>::is_bid;
+
+  BookSide(Price tick, size_t num_ticks) : ladder(tick, num_ticks) {}
+
+  [[nodiscard]] Level* find(Price price) noexcept { return ladder.find(price); }
+  [[nodiscard]] const Level* find(Price price) const noexcept {
+    return ladder.find(price);
+  }
+
+  void prefetch(Price price) const noexcept { ladder.prefetch(price); }
+
+  // levels are only ever created to put an order in, so a level that comes
+  // back empty is new and may be the new best
+  Level& emplace(Price price) {
+    auto& level = ladder.emplace(price);
+    if (level.empty() && (!cached_best || better(price, *cached_best))) {
+      cached_best = price;
+    }
+    return level;
+  }
+
+  void erase(Price price) {
+    ladder.erase(price);
+    if (price == cached_best) {
+      cached_best = next_worse(price);
+    }
+  }
+
+  [[nodiscard]] bool empty() const noexcept { return ladder.empty(); }
+  [[nodiscard]] size_t size() const noexcept { return ladder.size(); }
+
+  // cached, so reading the top of book never touches the bitmap
+  [[nodiscard]] std::optional<Price> best() const noexcept {
+    return cached_best;
+  }
+
+  [[nodiscard]] std::optional<Price> worst() const noexcept {
+    return is_bid ? ladder.lowest() : ladder.highest();
+  }
+
+  // the next non-empty level strictly further from / closer to the touch
+  [[nodiscard]] std::optional<Price> next_worse(Price price) const noexcept {
+    return is_bid ? ladder.next_lower(price) : ladder.next_higher(price);
+  }
+
+  [[nodiscard]] std::optional<Price> next_better(Price price) const noexcept {
+    return is_bid ? ladder.next_higher(price) : ladder.next_lower(price);
+  }
+
+private:
+  PriceLadder<Price, Level> ladder;
+  std::optional<Price> cached_best;
+};
+
+template <Side S, typename Price, typename Level>
+class TreeSide : public SideOrdering<S, Price> {
+public:
+  // same constructor as BookSide so the two are interchangeable, the ladder
+  // geometry just doesn't apply
+  TreeSide(Price /*tick*/, size_t /*num_ticks*/) {}
+
+  [[nodiscard]] Level* find(Price price) noexcept {
+    auto it = levels.find(price);
+    return it == levels.end() ? nullptr : &it->second;
+  }
+  [[nodiscard]] const Level* find(Price price) const noexcept {
+    return const_cast<TreeSide*>(this)->find(price);
+  }
+
+  // nothing worth chasing ahead of a tree walk
+  void prefetch(Price /*price*/) const noexcept {}
+
+  Level& emplace(Price price) { return levels[price]; }
+  void erase(Price price) { levels.erase(price); }
+
+  [[nodiscard]] bool empty() const noexcept { return levels.empty(); }
+  [[nodiscard]] size_t size() const noexcept { return levels.size(); }
+
+  // the comparator sorts best first, so the touch is always begin()
+  [[nodiscard]] std::optional<Price> best() const noexcept {
+    if (levels.empty())
+      return std::nullopt;
+    return levels.begin()->first;
+  }
+
+  [[nodiscard]] std::optional<Price> worst() const noexcept {
+    if (levels.empty())
+      return std::nullopt;
+    return levels.rbegin()->first;
+  }
+
+  [[nodiscard]] std::optional<Price> next_worse(Price price) const noexcept {
+    auto it = levels.upper_bound(price);
+    if (it == levels.end())
+      return std::nullopt;
+    return it->first;
+  }
+
+  [[nodiscard]] std::optional<Price> next_better(Price price) const noexcept {
+    auto it = levels.lower_bound(price);
+    if (it == levels.begin())
+      return std::nullopt;
+    return std::prev(it)->first;
+  }
+
+private:
+  using Compare = std::conditional_t<S == Side::Bid, std::greater<Price>,
+                                     std::less<Price>>;
+  std::map<Price, Level, Compare> levels;
+};
+
+template <Side S, typename Price, typename Level>
+class FlatSide : public SideOrdering<S, Price> {
+public:
+  using SideOrdering<S, Price>::better;
+
+  // no window, and nothing allocated until the first level arrives
+  FlatSide(Price /*tick*/, size_t /*num_ticks*/) {}
+
+  [[nodiscard]] Level* find(Price price) noexcept {
+    auto idx = position(price);
+    return idx < prices.size() && prices[idx] == price ? &levels[idx]
+                                                       : nullptr;
+  }
+  [[nodiscard]] const Level* find(Price price) const noexcept {
+    return const_cast<FlatSide*>(this)->find(price);
+  }
+
+  void prefetch(Price /*price*/) const noexcept {}
+
+  // unlike the ladder and the tree, levels move: a reference from find or
+  // emplace only lasts until the next emplace / erase
+  Level& emplace(Price price) {
+    auto idx = position(price);
+    if (idx == prices.size() || prices[idx] != price) {
+      prices.insert(prices.begin() + static_cast<ptrdiff_t>(idx), price);
+      levels.insert(levels.begin() + static_cast<ptrdiff_t>(idx), Level{});
+    }
+    return levels[idx];
+  }
+
+  void erase(Price price) {
+    auto idx = position(price);
+    if (idx < prices.size() && prices[idx] == price) {
+      prices.erase(prices.begin() + static_cast<ptrdiff_t>(idx));
+      levels.erase(levels.begin() + static_cast<ptrdiff_t>(idx));
+    }
+  }
+
+  [[nodiscard]] bool empty() const noexcept { return prices.empty(); }
+  [[nodiscard]] size_t size() const noexcept { return prices.size(); }
+
+  // stored worst first, so the touch, where nearly all the updates land, is
+  // at the back and inserting or erasing there moves next to nothing
+  [[nodiscard]] std::optional<Price> best() const noexcept {
+    if (prices.empty())
+      return std::nullopt;
+    return prices.back();
+  }
+
+  [[nodiscard]] std::optional<Price> worst() const noexcept {
+    if (prices.empty())
+      return std::nullopt;
+    return prices.front();
+  }
+
+  [[nodiscard]] std::optional<Price> next_worse(Price price) const noexcept {
+    auto idx = position(price);
+    if (idx == 0)
+      return std::nullopt;
+    return prices[idx - 1];
+  }
+
+  [[nodiscard]] std::optional<Price> next_better(Price price) const noexcept {
+    auto it = std::upper_bound(prices.begin(), prices.end(), price, worse);
+    if (it == prices.end())
+      return std::nullopt;
+    return *it;
+  }
+
+  // bytes held by the two vectors
+  [[nodiscard]] size_t memory_usage() const noexcept {
+    return prices.capacity() * sizeof(Price) +
+           levels.capacity() * sizeof(Level);
+  }
+
+private:
+  static bool worse(Price a, Price b) noexcept { return better(b, a); }
+
+  // index of the first level at price or better
+  [[nodiscard]] size_t position(Price price) const noexcept {
+    return static_cast<size_t>(
+        std::lower_bound(prices.begin(), prices.end(), price, worse) -
+        prices.begin());
+  }
+
+  // prices apart from the levels, so a lookup binary searches a dense array
+  std::vector<Price> prices;
+  std::vector<Level> levels;
+};
+
+// the one place a runtime side turns into a BookSide. f is called with bids or
+// asks, so everything it does is compiled once per side
+template <typename Bids, typename Asks, typename F>
+decltype(auto) visit_side(Side side, Bids& bids, Asks& asks, F&& f) {
+  return side == Side::Bid ? f(bids) : f(asks);
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include "log_histogram.hpp"
+#include <atomic>
+#include <cstdint>
+
+#if defined(BOOK_STATS) && defined(__x86_64__)
+#include <x86intrin.h>
+#elif defined(BOOK_STATS)
+#include <chrono>
+#endif
+
+// opt in hot path instrumentation for the order book, `make STATS=1 ...`
+//
+// without BOOK_STATS every type in here is empty and every call is an inline
+// no-op, so an instrumented book compiles down to exactly the uninstrumented
+// one. with it, each public operation is timed with rdtsc and we count level
+// creations/erasures and the index probe length of every lookup
+//
+// the counters are written by the thread that owns the book and nobody else,
+// so they're relaxed atomics bumped with a plain load + store (no lock prefix,
+// no fences). any other thread can call snapshot() at any time: each counter it
+// reads is exact, though the counters aren't captured at one single instant
+
+enum class StatOp : uint8_t { Add, Delete, Modify };
+
+inline constexpr size_t stat_op_count = 3;
+
+// cycle counts are bucketed exactly below 16, then 8 buckets per power of two
+// (within 12.5%), which covers the whole uint64 range in 496 buckets
+using CycleBuckets = LogLinearBuckets<3>;
+inline constexpr size_t cycle_buckets = CycleBuckets::count;
+
+// probe lengths 0 (a direct window hit) up to 15, then one bucket for 16+
+inline constexpr size_t probe_buckets = 17;
+
+struct CycleHistogram {
+  std::array<uint64_t, cycle_buckets> counts{};
+  uint64_t total = 0;
+  uint64_t max = 0;
+
+  [[nodiscard]] uint64_t percentile(double p) const noexcept {
+    return CycleBuckets::percentile(counts, total, max, p);
+  }
+};
+
+// plain copy of the counters, safe to keep and compare
+struct BookStatsSnapshot {
+  std::array<CycleHistogram, stat_op_count> cycles{};
+  uint64_t levels_created = 0;
+  uint64_t levels_erased = 0;
+  std::array<uint64_t, probe_buckets> probes{};
+};
+
+#ifdef BOOK_STATS
+
+[[nodiscard]] inline uint64_t read_cycles() noexcept {
+#if defined(__x86_64__)
+  return __rdtsc();
+#else
+  return static_cast<uint64_t>(
+      std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+class BookStats {
+public:
+  // rdtsc isn't serializing, so a few instructions either side of the
+  // operation can leak in or out. fine at the resolution we bucket at
+  class Timer {
+  public:
+    Timer(BookStats& stats, StatOp op) noexcept
+        : owner(stats), kind(op), start(read_cycles()) {}
+    ~Timer() { owner.record(kind, read_cycles() - start); }
+
+    Timer(const Timer& other) = delete;
+    Timer& operator=(const Timer& other) = delete;
+
+  private:
+    BookStats& owner;
+    StatOp kind;
+    uint64_t start;
+  };
+
+  void record(StatOp op, uint64_t cycles) noexcept {
+    auto& hist = latency[static_cast<size_t>(op)];
+    bump(hist.counts[CycleBuckets::index_of(cycles)]);
+    bump(hist.total);
+    if (cycles > hist.max.load(std::memory_order_relaxed))
+      hist.max.store(cycles, std::memory_order_relaxed);
+  }
+
+  void level_created() noexcept { bump(created); }
+  void level_erased() noexcept { bump(erased); }
+  void probe(uint32_t length) noexcept {
+    bump(probes[std::min<size_t>(length, probe_buckets - 1)]);
+  }
+
+  [[nodiscard]] BookStatsSnapshot snapshot() const noexcept {
+    BookStatsSnapshot out;
+    for (size_t op = 0; op < stat_op_count; ++op) {
+      for (size_t i = 0; i < cycle_buckets; ++i)
+        out.cycles[op].counts[i] =
+            latency[op].counts[i].load(std::memory_order_relaxed);
+      out.cycles[op].total = latency[op].total.load(std::memory_order_relaxed);
+      out.cycles[op].max = latency[op].max.load(std::memory_order_relaxed);
+    }
+    out.levels_created = created.load(std::memory_order_relaxed);
+    out.levels_erased = erased.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < probe_buckets; ++i)
+      out.probes[i] = probes[i].load(std::memory_order_relaxed);
+    return out;
+  }
+
+private:
+  using Counter = std::atomic<uint64_t>;
+  static_assert(Counter::is_always_lock_free);
+
+  // single writer, so no read-modify-write needed
+  static void bump(Counter& counter) noexcept {
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+  }
+
+  struct AtomicHistogram {
+    std::array<Counter, cycle_buckets> counts{};
+    Counter total{0};
+    Counter max{0};
+  };
+
+  std::array<AtomicHistogram, stat_op_count> latency{};
+  Counter created{0};
+  Counter erased{0};
+  std::array<Counter, probe_buckets> probes{};
+};
+
+inline constexpr bool book_stats_enabled = true;
+
+#else
+
+class BookStats {
+public:
+  class Timer {
+  public:
+    Timer(BookStats&, StatOp) noexcept {}
+  };
+
+  void record(StatOp, uint64_t) noexcept {}
+  void level_created() noexcept {}
+  void level_erased() noexcept {}
+  void probe(uint32_t) noexcept {}
+
+  [[nodiscard]] BookStatsSnapshot snapshot() const noexcept { return {}; }
+};
+
+inline constexpr bool book_stats_enabled = false;
+
+#endif
@@ -1,101 +1,195 @@
+#include "circular_buffer.hpp"
+#include <array>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
-#include <optional>
-#include <ostream>
-#include <utility>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <vector>
 
-// our circular buffer will use two pointers, a head and a tail
-// to control where we can insert and remove elements from
-//
-// we'll reserve capacity + 1 in our buffer to distinguish between an
-// empty and a full circular buffer
+// `./build/circular_buffer bench` times a handoff of count items between two
+// threads through an spsc ring of the given size, batch items per push / pop
+// (batch 1 is plain push / pop, anything more push_bulk / pop_bulk). a side
+// that finds the ring full / empty yields, so this still finishes when both
+// share a core
+void bench_spsc(uint64_t count, size_t ring_size, size_t batch) {
+  SpscCircularBuffer<uint64_t> ring(ring_size);
+  auto start = std::chrono::steady_clock::now();
+  std::thread producer([&ring, count, batch] {
+    if (batch == 1) {
+      for (uint64_t i = 1; i <= count; ++i) {
+        while (!ring.push(i))
+          std::this_thread::yield();
+      }
+      return;
+    }
+    std::vector<uint64_t> items(batch);
+    for (uint64_t next = 1; next <= count;) {
+      auto n = std::min<uint64_t>(batch, count - next + 1);
+      for (uint64_t i = 0; i < n; ++i)
+        items[i] = next + i;
+      for (auto pending = std::span<const uint64_t>(items).first(n);
+           !pending.empty();) {
+        auto pushed = ring.push_bulk(pending);
+        if (pushed == 0)
+          std::this_thread::yield();
+        pending = pending.subspan(pushed);
+      }
+      next += n;
+    }
+  });
 
-template <typename T>
-class CircularBuffer {
-public:
-  CircularBuffer(size_t capacity)
-      : read_pos(0), write_pos(0), buffer(new T[capacity + 1]),
-        capacity(capacity + 1) {}
-
-  ~CircularBuffer() { delete[] buffer; }
-
-  // managing raw pointers, no copy
-  CircularBuffer(const CircularBuffer& other) = delete;
-  CircularBuffer& operator=(const CircularBuffer& other) = delete;
-
-  CircularBuffer(CircularBuffer&& other) noexcept
-      : read_pos(std::exchange(other.read_pos, 0)),
-        write_pos(std::exchange(other.write_pos, 0)),
-        buffer(std::exchange(other.buffer, nullptr)),
-        capacity(std::exchange(other.capacity, 0)) {}
-
-  CircularBuffer& operator=(CircularBuffer&& other) noexcept {
-    if (this == &other)
-      return *this;
-
-    if (buffer)
-      delete[] buffer;
-    read_pos = std::exchange(other.read_pos, 0);
-    write_pos = std::exchange(other.write_pos, 0);
-    buffer = std::exchange(other.buffer, nullptr);
-    capacity = std::exchange(other.capacity, 0);
-
-    return *this;
+  uint64_t sum = 0;
+  std::vector<uint64_t> out(batch);
+  for (uint64_t popped = 0; popped < count;) {
+    size_t n = 0;
+    if (batch == 1) {
+      if (auto val = ring.pop()) {
+        out[0] = *val;
+        n = 1;
+      }
+    } else {
+      n = ring.pop_bulk(out);
+    }
+    if (n == 0)
+      std::this_thread::yield();
+    for (size_t i = 0; i < n; ++i)
+      sum += out[i];
+    popped += n;
   }
+  producer.join();
+  auto seconds = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  std::cout << "spsc ring " << ring.capacity() << " batch " << batch << ": "
+            << static_cast<double>(count) / seconds / 1e6 << " M items/s"
+            << (sum == count * (count + 1) / 2 ? "" : " (WRONG SUM)") << "\n";
+}
 
-  // empty: head = tail
-  // full: tail + 1 = head
+// what the gateways do today: a plain CircularBuffer behind a mutex
+template <typename T>
+class LockedCircularBuffer {
+public:
+  explicit LockedCircularBuffer(size_t max_items) : ring(max_items) {}
 
   bool push(T value) {
-    if (increment(write_pos) == read_pos) {
-      return false;
-    }
-
-    buffer[write_pos] = value;
-    write_pos = increment(write_pos);
-    return true;
-  };
+    std::lock_guard guard(lock);
+    return ring.push(std::move(value));
+  }
 
   std::optional<T> pop() {
-    if (read_pos == write_pos) {
-      return std::nullopt;
-    }
-
-    // nit: move here for eg if buffer is non-trivial type
-    auto ret = std::make_optional(std::move(buffer[read_pos]));
-    read_pos = increment(read_pos);
-    return ret;
+    std::lock_guard guard(lock);
+    return ring.pop();
   }
 
-  [[nodiscard]] size_t size() const {
-    if (read_pos <= write_pos) {
-      return write_pos - read_pos;
-    } else {
-      // head > tail
-      // so head... end of array
-      // then start of array to tail
-      return capacity - read_pos + write_pos;
-    }
+private:
+  std::mutex lock;
+  CircularBuffer<T> ring;
+};
+
+// pushes 1..count from num_producers threads and pops them on num_consumers
+// threads, returning the sum of what was popped. consumers stop once the
+// producers have all finished and the ring is empty, which a failed pop after
+// seeing `done` proves, since nothing can be mid push by then
+template <typename Ring>
+uint64_t transfer(Ring& ring, size_t num_producers, size_t num_consumers,
+                  uint64_t count) {
+  std::atomic<bool> done{false};
+  std::vector<uint64_t> sums(num_consumers * 8); // a line apart
+
+  std::vector<std::thread> consumers;
+  for (size_t c = 0; c < num_consumers; ++c) {
+    consumers.emplace_back([&, c] {
+      uint64_t sum = 0;
+      for (;;) {
+        bool finished = done.load(std::memory_order_acquire);
+        if (auto val = ring.pop()) {
+          sum += *val;
+        } else if (finished) {
+          break;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+      sums[c * 8] = sum;
+    });
   }
 
-  friend std::ostream& operator<<(std::ostream& os, const CircularBuffer& cb) {
-    size_t curr = cb.read_pos;
-    while (curr != cb.write_pos) {
-      std::cout << cb.buffer[curr] << " ";
-      curr = cb.increment(curr);
-    }
-    return os;
+  std::vector<std::thread> producers;
+  for (size_t p = 0; p < num_producers; ++p) {
+    producers.emplace_back([&, p] {
+      for (uint64_t i = p + 1; i <= count; i += num_producers) {
+        while (!ring.push(i))
+          std::this_thread::yield();
+      }
+    });
   }
+  for (auto& producer : producers)
+    producer.join();
+  done.store(true, std::memory_order_release);
+  for (auto& consumer : consumers)
+    consumer.join();
 
-private:
-  size_t increment(size_t pos) const { return (pos + 1) % capacity; }
+  uint64_t sum = 0;
+  for (size_t c = 0; c < num_consumers; ++c)
+    sum += sums[c * 8];
+  return sum;
+}
+
+// M items/s for a transfer of count items
+template <typename Ring>
+double bench_mpmc(size_t num_producers, size_t num_consumers, uint64_t count) {
+  Ring ring(1024);
+  auto start = std::chrono::steady_clock::now();
+  auto sum = transfer(ring, num_producers, num_consumers, count);
+  auto seconds = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  if (sum != count * (count + 1) / 2)
+    std::cout << "WRONG SUM ";
+  return static_cast<double>(count) / seconds / 1e6;
+}
+
+// counts live instances, to show what the rings construct and destroy. no
+// default constructor, which the rings no longer need
+struct Tracked {
+  static inline int live = 0;
+
+  explicit Tracked(int v) : value(v) { ++live; }
+  Tracked(const Tracked& other) : value(other.value) { ++live; }
+  Tracked(Tracked&& other) noexcept : value(other.value) { ++live; }
+  Tracked& operator=(const Tracked& other) = default;
+  Tracked& operator=(Tracked&& other) noexcept = default;
+  ~Tracked() { --live; }
 
-  size_t read_pos;
-  size_t write_pos;
-  T* buffer;
-  size_t capacity;
+  int value;
 };
 
-int main() {
+int main(int argc, char** argv) {
+  if (argc == 2 && std::string_view(argv[1]) == "bench") {
+    for (size_t ring_size : {64, 1024, 65536}) {
+      for (size_t batch : {1, 32, 256})
+        bench_spsc(10'000'000, ring_size, batch);
+    }
+
+    // M items/s through a 1024 slot ring, lock free against locked
+    auto max_threads = std::max<size_t>(std::thread::hardware_concurrency(), 4);
+    std::cout << "producers consumers  mpmc  locked\n";
+    for (size_t producers = 1; producers <= max_threads; producers *= 2) {
+      for (size_t consumers = 1; consumers <= max_threads; consumers *= 2) {
+        auto lock_free = bench_mpmc<MpmcCircularBuffer<uint64_t>>(
+            producers, consumers, 2'000'000);
+        auto with_lock = bench_mpmc<LockedCircularBuffer<uint64_t>>(
+            producers, consumers, 2'000'000);
+        std::cout << producers << " " << consumers << " " << lock_free << " "
+                  << with_lock << "\n";
+      }
+    }
+    return 0;
+  }
+
   CircularBuffer<int> cb(5);
 
   cb.push(1);
@@ -125,6 +219,76 @@ int main() {
   std::cout << cb << "\n";
   std::cout << cb.size() << "\n";
 
+  // bulk: only two of the four fit. popping everything back out wraps around
+  // the end of the array
+  std::array<int, 4> more{10, 11, 12, 13};
+  std::cout << cb.push_bulk(more) << "\n"; // 2
+  std::array<int, 8> out{};
+  auto popped_bulk = cb.pop_bulk(out);
+  for (size_t i = 0; i < popped_bulk; ++i)
+    std::cout << out[i] << " "; // 5 6 7 10 11
+  std::cout << "\n";
+
+  // spsc: one thread pushes 1..100000 through a small ring, main pops. both
+  // yield on a full / empty ring, as in bench_spsc
+  SpscCircularBuffer<uint64_t> spsc(64);
+  std::thread producer([&spsc] {
+    for (uint64_t i = 1; i <= 100000; ++i) {
+      while (!spsc.push(i))
+        std::this_thread::yield();
+    }
+  });
+
+  uint64_t sum = 0;
+  for (size_t popped = 0; popped < 100000;) {
+    if (auto val = spsc.pop()) {
+      sum += *val;
+      ++popped;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  std::cout << sum << "\n"; // 5000050000
+
+  // items are built in their slots and destroyed as they leave
+  {
+    CircularBuffer<Tracked> tracked(4);
+    tracked.emplace(1);
+    tracked.emplace(2);
+    tracked.emplace(3);
+    std::cout << Tracked::live << "\n"; // 3
+
+    // worked on in place, never moved out
+    if (auto* front = tracked.try_front()) {
+      front->value += 10;
+      std::cout << front->value << "\n"; // 11
+      tracked.consume();
+    }
+    std::cout << Tracked::live << "\n"; // 2
+
+    auto val = tracked.pop();
+    std::cout << val->value << " " << Tracked::live << "\n"; // 2 2
+  }
+  std::cout << Tracked::live << "\n"; // 0, the ring destroyed what was left
+
+  // the mpmc ring too: nothing is alive in a slot that isn't holding an item
+  {
+    MpmcCircularBuffer<Tracked> tracked(4);
+    std::cout << Tracked::live << "\n"; // 0
+    tracked.emplace(1);
+    tracked.push(Tracked(2));
+    std::cout << Tracked::live << "\n"; // 2
+
+    auto val = tracked.pop();
+    std::cout << val->value << " " << Tracked::live << "\n"; // 1 2
+  }
+  std::cout << Tracked::live << "\n"; // 0
+
+  // mpmc: four producers push 1..100000 between them, four consumers pop
+  MpmcCircularBuffer<uint64_t> mpmc(64);
+  std::cout << transfer(mpmc, 4, 4, 100000) << "\n"; // 5000050000
+
   return 0;
 }
 
@@ -0,0 +1,458 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+// ring slots are raw, suitably aligned storage. an item is constructed in its
+// slot when it's pushed and destroyed when it's popped, so T needn't be default
+// constructible, and nothing moved-from is left sitting in a slot
+template <typename T>
+[[nodiscard]] T* allocate_slots(size_t count) {
+  return static_cast<T*>(
+      ::operator new(count * sizeof(T), std::align_val_t{alignof(T)}));
+}
+
+template <typename T>
+void free_slots(T* slots) noexcept {
+  ::operator delete(slots, std::align_val_t{alignof(T)});
+}
+
+// bulk transfers in and out of a ring are at most two contiguous runs, one up
+// to the end of the array and one from the start. for trivially copyable T
+// each run is a single memcpy
+
+// copies count items into empty slots
+template <typename T>
+void copy_into_slots(const T* from, size_t count, T* to) {
+  if constexpr (std::is_trivially_copyable_v<T>) {
+    if (count > 0)
+      std::memcpy(static_cast<void*>(to), from, count * sizeof(T));
+  } else {
+    std::uninitialized_copy_n(from, count, to);
+  }
+}
+
+// moves count items out of their slots, leaving the slots empty
+template <typename T>
+void move_out_of_slots(T* from, size_t count, T* to) {
+  if constexpr (std::is_trivially_copyable_v<T>) {
+    if (count > 0)
+      std::memcpy(static_cast<void*>(to), from, count * sizeof(T));
+  } else {
+    std::move(from, from + count, to);
+    std::destroy_n(from, count);
+  }
+}
+
+// our circular buffer will use two pointers, a head and a tail
+// to control where we can insert and remove elements from
+//
+// we'll reserve capacity + 1 in our buffer to distinguish between an
+// empty and a full circular buffer
+
+template <typename T>
+class CircularBuffer {
+public:
+  CircularBuffer(size_t max_items)
+      : read_pos(0), write_pos(0), buffer(allocate_slots<T>(max_items + 1)),
+        capacity(max_items + 1) {}
+
+  ~CircularBuffer() { release(); }
+
+  // managing raw pointers, no copy
+  CircularBuffer(const CircularBuffer& other) = delete;
+  CircularBuffer& operator=(const CircularBuffer& other) = delete;
+
+  CircularBuffer(CircularBuffer&& other) noexcept
+      : read_pos(std::exchange(other.read_pos, 0)),
+        write_pos(std::exchange(other.write_pos, 0)),
+        buffer(std::exchange(other.buffer, nullptr)),
+        capacity(std::exchange(other.capacity, 0)) {}
+
+  CircularBuffer& operator=(CircularBuffer&& other) noexcept {
+    if (this == &other)
+      return *this;
+
+    release();
+    read_pos = std::exchange(other.read_pos, 0);
+    write_pos = std::exchange(other.write_pos, 0);
+    buffer = std::exchange(other.buffer, nullptr);
+    capacity = std::exchange(other.capacity, 0);
+
+    return *this;
+  }
+
+  // empty: head = tail
+  // full: tail + 1 = head
+
+  bool push(T value) { return emplace(std::move(value)); }
+
+  // constructs the item straight into its slot
+  template <typename... Args>
+  bool emplace(Args&&... args) {
+    if (increment(write_pos) == read_pos) {
+      return false;
+    }
+
+    std::construct_at(buffer + write_pos, std::forward<Args>(args)...);
+    write_pos = increment(write_pos);
+    return true;
+  }
+
+  std::optional<T> pop() {
+    if (read_pos == write_pos) {
+      return std::nullopt;
+    }
+
+    // nit: move here for eg if buffer is non-trivial type
+    auto ret = std::make_optional(std::move(buffer[read_pos]));
+    consume();
+    return ret;
+  }
+
+  // the oldest item, left in its slot, or nullptr if empty. for working on an
+  // item in place and then consume()ing it, rather than moving it out
+  [[nodiscard]] T* try_front() noexcept {
+    return read_pos == write_pos ? nullptr : buffer + read_pos;
+  }
+
+  // destroys the oldest item. only after try_front() returned one
+  void consume() noexcept {
+    std::destroy_at(buffer + read_pos);
+    read_pos = increment(read_pos);
+  }
+
+  // pushes as many of items as fit, in order, and returns how many that was
+  size_t push_bulk(std::span<const T> items) {
+    auto count = std::min(items.size(), capacity - 1 - size());
+    auto first = std::min(count, capacity - write_pos);
+    copy_into_slots(items.data(), first, buffer + write_pos);
+    copy_into_slots(items.data() + first, count - first, buffer);
+    write_pos = (write_pos + count) % capacity;
+    return count;
+  }
+
+  // pops up to out.size() items into out and returns how many
+  size_t pop_bulk(std::span<T> out) {
+    auto count = std::min(out.size(), size());
+    auto first = std::min(count, capacity - read_pos);
+    move_out_of_slots(buffer + read_pos, first, out.data());
+    move_out_of_slots(buffer, count - first, out.data() + first);
+    read_pos = (read_pos + count) % capacity;
+    return count;
+  }
+
+  [[nodiscard]] size_t size() const {
+    if (read_pos <= write_pos) {
+      return write_pos - read_pos;
+    } else {
+      // head > tail
+      // so head... end of array
+      // then start of array to tail
+      return capacity - read_pos + write_pos;
+    }
+  }
+
+  friend std::ostream& operator<<(std::ostream& os, const CircularBuffer& cb) {
+    size_t curr = cb.read_pos;
+    while (curr != cb.write_pos) {
+      std::cout << cb.buffer[curr] << " ";
+      curr = cb.increment(curr);
+    }
+    return os;
+  }
+
+private:
+  size_t increment(size_t pos) const { return (pos + 1) % capacity; }
+
+  // destroys whatever is still queued and frees the slots
+  void release() noexcept {
+    while (read_pos != write_pos)
+      consume();
+    free_slots(buffer);
+  }
+
+  size_t read_pos;
+  size_t write_pos;
+  T* buffer;
+  size_t capacity;
+};
+
+// single producer / single consumer flavour of the above, so that one thread
+// can push while another pops. each index is only ever written by one side:
+// - write_pos is owned by the producer, published with release once the slot
+//   has been written
+// - read_pos is owned by the consumer, published with release once the slot
+//   has been moved out
+// and each side acquires the other's index before touching a slot
+//
+// the indices count up forever and are masked into a power of two sized
+// array, so there's no modulo and no wasted slot: full is write - read ==
+// capacity. each index sits on its own cache line together with its owner's
+// cached copy of the other index. a side only reloads the other's index when
+// its cached copy says the ring is full (or empty), so while the ring is
+// neither, producer and consumer don't touch each other's lines at all
+template <typename T>
+class SpscCircularBuffer {
+public:
+  // room for at least max_items, rounded up to a power of two
+  explicit SpscCircularBuffer(size_t max_items)
+      : mask(std::bit_ceil(std::max<size_t>(max_items, 1)) - 1),
+        buffer(allocate_slots<T>(mask + 1)) {}
+
+  // by now both sides have stopped
+  ~SpscCircularBuffer() {
+    auto write = write_pos.load(std::memory_order_acquire);
+    for (auto read = read_pos.load(std::memory_order_acquire); read != write;
+         ++read)
+      std::destroy_at(buffer + (read & mask));
+    free_slots(buffer);
+  }
+
+  // shared between threads, so neither copyable nor movable
+  SpscCircularBuffer(const SpscCircularBuffer& other) = delete;
+  SpscCircularBuffer& operator=(const SpscCircularBuffer& other) = delete;
+
+  // producer only
+  bool push(T value) { return emplace(std::move(value)); }
+
+  // producer only. constructs the item straight into its slot
+  template <typename... Args>
+  bool emplace(Args&&... args) {
+    auto write = write_pos.load(std::memory_order_relaxed);
+    if (write - cached_read_pos > mask) {
+      cached_read_pos = read_pos.load(std::memory_order_acquire);
+      if (write - cached_read_pos > mask)
+        return false;
+    }
+
+    std::construct_at(buffer + (write & mask), std::forward<Args>(args)...);
+    write_pos.store(write + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer only
+  std::optional<T> pop() {
+    auto* front = try_front();
+    if (!front)
+      return std::nullopt;
+
+    auto ret = std::make_optional(std::move(*front));
+    consume();
+    return ret;
+  }
+
+  // consumer only. the oldest item, left in its slot, or nullptr if empty.
+  // the producer won't touch the slot until it's been consume()d, so the
+  // consumer can work on the item in place
+  [[nodiscard]] T* try_front() noexcept {
+    auto read = read_pos.load(std::memory_order_relaxed);
+    if (read == cached_write_pos) {
+      cached_write_pos = write_pos.load(std::memory_order_acquire);
+      if (read == cached_write_pos)
+        return nullptr;
+    }
+    return buffer + (read & mask);
+  }
+
+  // consumer only. destroys the oldest item and hands its slot back to the
+  // producer. only after try_front() returned one
+  void consume() noexcept {
+    auto read = read_pos.load(std::memory_order_relaxed);
+    std::destroy_at(buffer + (read & mask));
+    read_pos.store(read + 1, std::memory_order_release);
+  }
+
+  // producer only. pushes as many of items as fit and publishes them all with
+  // one store, so the consumer sees the whole batch at once. returns how many
+  size_t push_bulk(std::span<const T> items) {
+    auto write = write_pos.load(std::memory_order_relaxed);
+    if (capacity() - (write - cached_read_pos) < items.size())
+      cached_read_pos = read_pos.load(std::memory_order_acquire);
+    auto count = std::min(items.size(), capacity() - (write - cached_read_pos));
+
+    auto start = write & mask;
+    auto first = std::min(count, capacity() - start);
+    copy_into_slots(items.data(), first, buffer + start);
+    copy_into_slots(items.data() + first, count - first, buffer);
+    write_pos.store(write + count, std::memory_order_release);
+    return count;
+  }
+
+  // consumer only. pops up to out.size() items and frees their slots with
+  // one store. returns how many
+  size_t pop_bulk(std::span<T> out) {
+    auto read = read_pos.load(std::memory_order_relaxed);
+    if (cached_write_pos - read < out.size())
+      cached_write_pos = write_pos.load(std::memory_order_acquire);
+    auto count = std::min(out.size(), cached_write_pos - read);
+
+    auto start = read & mask;
+    auto first = std::min(count, capacity() - start);
+    move_out_of_slots(buffer + start, first, out.data());
+    move_out_of_slots(buffer, count - first, out.data() + first);
+    read_pos.store(read + count, std::memory_order_release);
+    return count;
+  }
+
+  // only a snapshot when the other side is running
+  [[nodiscard]] size_t size() const {
+    auto read = read_pos.load(std::memory_order_acquire);
+    auto write = write_pos.load(std::memory_order_acquire);
+    return write - read;
+  }
+
+  [[nodiscard]] size_t capacity() const noexcept { return mask + 1; }
+
+private:
+  // set once in the constructor, read by both sides
+  size_t mask;
+  T* buffer;
+
+  // producer's line
+  alignas(64) std::atomic<size_t> write_pos{0};
+  size_t cached_read_pos = 0;
+
+  // consumer's line. the alignas also rounds sizeof up to a whole line, so
+  // whatever follows us in memory doesn't share it
+  alignas(64) std::atomic<size_t> read_pos{0};
+  size_t cached_write_pos = 0;
+};
+
+// bounded multi producer / multi consumer ring, same push / pop interface.
+// every slot carries a sequence number saying whose turn it is:
+// - seq == pos: empty, free for the producer that claims position pos
+// - seq == pos + 1: holds the item for the consumer that claims pos
+// and once that consumer is done it sets seq = pos + capacity, handing the
+// slot to the producer one lap later
+//
+// a producer claims a position with a single compare-exchange on enqueue_pos
+// (a consumer likewise on dequeue_pos), then writes its slot and publishes it
+// through the slot's sequence. no locks, and the only shared counter is touched
+// once per successful operation. a thread that loses the race for a position
+// just retries with the next one. full / empty fall out of the sequence
+// comparison without looking at the other side's counter at all
+//
+// next to its sequence a slot is raw storage, like the other rings: the item
+// is constructed there by the producer and destroyed by the consumer that pops
+// it
+template <typename T>
+class MpmcCircularBuffer {
+public:
+  // room for at least max_items, rounded up to a power of two. at least 2,
+  // with 1 slot "empty for this lap" and "full from the last" look the same
+  explicit MpmcCircularBuffer(size_t max_items)
+      : mask(std::bit_ceil(std::max<size_t>(max_items, 2)) - 1),
+        slots(new Slot[mask + 1]) {
+    for (size_t i = 0; i <= mask; ++i)
+      slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  // by now every thread has stopped, so each position between the counters
+  // holds a finished item
+  ~MpmcCircularBuffer() {
+    auto write = enqueue_pos.load(std::memory_order_acquire);
+    for (auto read = dequeue_pos.load(std::memory_order_acquire); read != write;
+         ++read)
+      std::destroy_at(slots[read & mask].item());
+    delete[] slots;
+  }
+
+  // shared between threads, so neither copyable nor movable
+  MpmcCircularBuffer(const MpmcCircularBuffer& other) = delete;
+  MpmcCircularBuffer& operator=(const MpmcCircularBuffer& other) = delete;
+
+  // any thread. false if the ring is full
+  bool push(T value) { return emplace(std::move(value)); }
+
+  // any thread. constructs the item straight into its slot
+  template <typename... Args>
+  bool emplace(Args&&... args) {
+    auto pos = enqueue_pos.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+      slot = &slots[pos & mask];
+      auto seq = slot->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<ptrdiff_t>(seq - pos);
+      if (diff == 0) {
+        // our turn, if nobody else claims pos first. on failure pos is
+        // reloaded for us
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        // still holds the item from a lap ago
+        return false;
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+
+    std::construct_at(slot->item(), std::forward<Args>(args)...);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // any thread. nullopt if the ring is empty
+  std::optional<T> pop() {
+    auto pos = dequeue_pos.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+      slot = &slots[pos & mask];
+      auto seq = slot->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<ptrdiff_t>(seq - (pos + 1));
+      if (diff == 0) {
+        if (dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        // not written yet
+        return std::nullopt;
+      } else {
+        pos = dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+
+    auto ret = std::make_optional(std::move(*slot->item()));
+    std::destroy_at(slot->item());
+    slot->sequence.store(pos + mask + 1, std::memory_order_release);
+    return ret;
+  }
+
+  // only a snapshot, and can be briefly off by the operations in flight
+  [[nodiscard]] size_t size() const {
+    auto read = dequeue_pos.load(std::memory_order_acquire);
+    auto write = enqueue_pos.load(std::memory_order_acquire);
+    return write > read ? write - read : 0;
+  }
+
+  [[nodiscard]] size_t capacity() const noexcept { return mask + 1; }
+
+private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    alignas(T) std::byte storage[sizeof(T)];
+
+    [[nodiscard]] T* item() noexcept {
+      return std::launder(reinterpret_cast<T*>(storage));
+    }
+  };
+
+  size_t mask;
+  Slot* slots;
+
+  // producers' and consumers' counters on separate lines
+  alignas(64) std::atomic<size_t> enqueue_pos{0};
+  alignas(64) std::atomic<size_t> dequeue_pos{0};
+};
@@ -0,0 +1,237 @@
+#pragma once
+
+#include "book_side.hpp"
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+// running totals of resting quantity and notional (price x qty) by price, for
+// one side of a book. they answer what a pre-trade risk check asks about every
+// inbound order: how much rests at or better than a price, what sweeping some
+// quantity would cost (and its vwap), and how deep that sweep would reach
+//
+// the totals sit in a Fenwick tree over a window of ticks like PriceLadder's,
+// indexed best price first, so an update and each of those queries is
+// O(log n) instead of a walk over every level and every order in it. the book
+// calls add / remove whenever the quantity resting at a price changes
+//
+// prices outside the window (or off the tick grid) go into a std::map, which
+// the queries walk. like the ladder's fallback it should stay nearly empty
+//
+// notional is price x qty in a uint64_t, keeping that in range is up to the
+// caller
+
+template <Side S, typename Price = uint64_t>
+class DepthIndex : public SideOrdering<S, Price> {
+public:
+  using SideOrdering<S, Price>::better;
+  using SideOrdering<S, Price>::is_bid;
+
+  struct Totals {
+    uint64_t qty = 0;
+    uint64_t notional = 0;
+  };
+
+  // walking the side from the best price for some quantity. qty comes back
+  // short if the side ran out first
+  struct Sweep {
+    uint64_t qty = 0;
+    uint64_t notional = 0;
+    std::optional<Price> last_price; // the worst price it had to reach
+
+    [[nodiscard]] double vwap() const noexcept {
+      return qty ? static_cast<double>(notional) / static_cast<double>(qty)
+                 : 0.0;
+    }
+  };
+
+  DepthIndex(Price tick_size, size_t num_ticks)
+      : tick(tick_size), tree(num_ticks + 1) {}
+
+  void add(Price price, uint64_t qty) {
+    if (empty() && !index_of(price)) {
+      recenter(price);
+    }
+    update(price, qty, qty * price);
+  }
+
+  // qty must be resting at price. deltas are unsigned and wrap, the tree only
+  // ever sums them back to the real (non negative) totals
+  void remove(Price price, uint64_t qty) {
+    update(price, 0 - qty, 0 - qty * price);
+  }
+
+  [[nodiscard]] bool empty() const noexcept {
+    return window_total.qty == 0 && overflow.empty();
+  }
+
+  [[nodiscard]] uint64_t total_qty() const noexcept {
+    auto qty = window_total.qty;
+    for (const auto& [price, totals] : overflow)
+      qty += totals.qty;
+    return qty;
+  }
+
+  // quantity resting at limit or better
+  [[nodiscard]] uint64_t qty_through(Price limit) const noexcept {
+    auto qty = window_through(limit).qty;
+    for (const auto& [price, totals] : overflow) {
+      if (better(limit, price))
+        break;
+      qty += totals.qty;
+    }
+    return qty;
+  }
+
+  // what taking qty off this side, best price first, would trade and cost
+  [[nodiscard]] Sweep sweep(uint64_t qty) const noexcept {
+    if (qty == 0)
+      return {};
+
+    // the fallback levels are visited in price order, and the tree is only
+    // descended into once the window levels ahead of one cover the rest
+    Totals taken;
+    std::optional<Price> last_taken;
+    for (const auto& [price, totals] : overflow) {
+      auto ahead = window_through(price);
+      if (taken.qty + ahead.qty >= qty)
+        return descend(taken, qty - taken.qty);
+
+      auto available = taken.qty + ahead.qty;
+      if (available + totals.qty >= qty) {
+        return {qty,
+                taken.notional + ahead.notional + (qty - available) * price,
+                price};
+      }
+      taken.qty += totals.qty;
+      taken.notional += totals.notional;
+      last_taken = price;
+    }
+
+    if (taken.qty + window_total.qty >= qty)
+      return descend(taken, qty - taken.qty);
+
+    // not enough on the whole side, take all of it
+    if (window_total.qty == 0)
+      return {taken.qty, taken.notional, last_taken};
+    auto all = descend(taken, window_total.qty);
+    if (last_taken && better(*all.last_price, *last_taken))
+      all.last_price = last_taken;
+    return all;
+  }
+
+  // the worst price a sweep of qty would reach, nullopt if there isn't qty
+  // on the side
+  [[nodiscard]] std::optional<Price> price_for(uint64_t qty) const noexcept {
+    auto result = sweep(qty);
+    if (result.qty < qty)
+      return std::nullopt;
+    return result.last_price;
+  }
+
+private:
+  [[nodiscard]] size_t num_slots() const noexcept { return tree.size() - 1; }
+
+  // slot 0 is the best price in the window, so "at or better" is a prefix
+  [[nodiscard]] std::optional<size_t> index_of(Price price) const noexcept {
+    if (price < base || (price - base) % tick != 0)
+      return std::nullopt;
+    auto offset = static_cast<size_t>((price - base) / tick);
+    if (offset >= num_slots())
+      return std::nullopt;
+    return is_bid ? num_slots() - 1 - offset : offset;
+  }
+
+  [[nodiscard]] Price price_of(size_t idx) const noexcept {
+    auto offset = is_bid ? num_slots() - 1 - idx : idx;
+    return base + static_cast<Price>(offset) * tick;
+  }
+
+  // only when the whole side is empty, so nothing in the tree or the fallback
+  // is stranded
+  void recenter(Price price) {
+    if (!overflow.empty())
+      return;
+    auto half = static_cast<Price>(num_slots() / 2) * tick;
+    base = price >= half ? static_cast<Price>(price - half)
+                         : static_cast<Price>(price % tick);
+  }
+
+  void update(Price price, uint64_t qty, uint64_t notional) {
+    auto idx = index_of(price);
+    if (!idx) {
+      auto& totals = overflow[price];
+      totals.qty += qty;
+      totals.notional += notional;
+      if (totals.qty == 0)
+        overflow.erase(price);
+      return;
+    }
+
+    window_total.qty += qty;
+    window_total.notional += notional;
+    for (auto i = *idx + 1; i < tree.size(); i += i & (0 - i)) {
+      tree[i].qty += qty;
+      tree[i].notional += notional;
+    }
+  }
+
+  // totals of the first count slots
+  [[nodiscard]] Totals prefix(size_t count) const noexcept {
+    Totals sum;
+    for (auto i = count; i > 0; i -= i & (0 - i)) {
+      sum.qty += tree[i].qty;
+      sum.notional += tree[i].notional;
+    }
+    return sum;
+  }
+
+  // totals of the window levels at limit or better. limit needn't be in the
+  // window or on the grid
+  [[nodiscard]] Totals window_through(Price limit) const noexcept {
+    if (limit < base)
+      return is_bid ? window_total : Totals{};
+    auto offset = (limit - base) / tick;
+    size_t count;
+    if constexpr (is_bid) {
+      // slots priced at or above limit, rounding a between ticks limit up
+      auto first = offset + ((limit - base) % tick != 0);
+      count = first >= num_slots() ? 0 : num_slots() - first;
+    } else {
+      count = offset >= num_slots() ? num_slots() : offset + 1;
+    }
+    return prefix(count);
+  }
+
+  // the usual Fenwick descent: finds the first slot at which the window's
+  // running quantity reaches qty (which it must), without a binary search
+  // over prefix sums
+  [[nodiscard]] Sweep descend(Totals before, uint64_t qty) const noexcept {
+    size_t pos = 0;
+    Totals sum;
+    for (auto step = std::bit_floor(num_slots()); step > 0; step >>= 1) {
+      if (pos + step < tree.size() && sum.qty + tree[pos + step].qty < qty) {
+        pos += step;
+        sum.qty += tree[pos].qty;
+        sum.notional += tree[pos].notional;
+      }
+    }
+    // pos is now the 0 based slot where it ends, partly taken
+    auto price = price_of(pos);
+    return {before.qty + qty,
+            before.notional + sum.notional + (qty - sum.qty) * price, price};
+  }
+
+  using Compare = std::conditional_t<S == Side::Bid, std::greater<Price>,
+                                     std::less<Price>>;
+
+  Price tick;
+  Price base = 0;
+  std::vector<Totals> tree; // 1 based
+  Totals window_total;
+  std::map<Price, Totals, Compare> overflow;
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "circular_buffer.hpp"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+// append only write ahead journal of fixed width records, with group commit
+//
+// the thread doing the mutations only pushes the record onto an SPSC ring. a
+// background writer wakes up every commit_interval, drains whatever has
+// accumulated, writes it with one write() and makes it durable with one
+// fdatasync(), so the cost of a sync is shared by every record in the batch
+//
+// the file is just the records back to back, the same layout as a binary
+// feed, so recovery is an mmap and a replay. a crash can leave a partial
+// record at the tail, which recovery ignores and opening the journal again
+// cuts off, so records appended after a restart stay aligned
+
+template <typename Record>
+class Journal {
+  static_assert(std::is_trivially_copyable_v<Record>);
+
+public:
+  // appends to path, creating it if needed, after dropping any partial
+  // record at its end. check is_open() afterwards
+  explicit Journal(const char* path, size_t ring_capacity = 65536,
+                   std::chrono::microseconds commit_interval =
+                       std::chrono::microseconds(1000))
+      : fd(open_whole_records(path)), ring(ring_capacity),
+        max_batch(ring_capacity), interval(commit_interval) {
+    if (fd >= 0)
+      writer = std::thread(&Journal::run, this);
+  }
+
+  ~Journal() { close(); }
+
+  // the writer thread points back at us
+  Journal(const Journal& other) = delete;
+  Journal& operator=(const Journal& other) = delete;
+
+  [[nodiscard]] bool is_open() const noexcept { return fd >= 0; }
+
+  // mutation thread only. a ring push, unless the writer has fallen a whole
+  // ring behind, in which case we wait for it rather than lose the record
+  void append(const Record& record) {
+    while (!ring.push(record)) {
+      ++full_waits;
+      std::this_thread::yield();
+    }
+    ++appended;
+  }
+
+  // records appended so far, mutation thread only
+  [[nodiscard]] uint64_t appended_count() const noexcept { return appended; }
+
+  // times append() found the ring full, mutation thread only
+  [[nodiscard]] uint64_t full_wait_count() const noexcept {
+    return full_waits;
+  }
+
+  // records known to be on disk. any thread, so a caller can hold back an
+  // acknowledgement until its record has been committed
+  [[nodiscard]] uint64_t durable_count() const noexcept {
+    return durable.load(std::memory_order_acquire);
+  }
+
+  // false once a write or sync has failed. nothing after that point is
+  // durable, and the writer stops trying
+  [[nodiscard]] bool healthy() const noexcept {
+    return !failed.load(std::memory_order_acquire);
+  }
+
+  // commits everything appended so far and stops the writer. called from the
+  // mutation thread (or implicitly on destruction)
+  void close() {
+    if (!writer.joinable())
+      return;
+    running.store(false, std::memory_order_release);
+    writer.join();
+    ::close(fd);
+  }
+
+private:
+  // O_APPEND writes go after whatever is in the file, so a torn record left
+  // by a crash would shift every record after it. trimming it first keeps
+  // the file a whole number of records
+  static int open_whole_records(const char* path) {
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+      return fd;
+    struct stat st;
+    if (::fstat(fd, &st) != 0 ||
+        ::ftruncate(fd, st.st_size - st.st_size % off_t{sizeof(Record)}) !=
+            0) {
+      ::close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  void run() {
+    std::vector<Record> batch;
+    batch.reserve(max_batch);
+    for (;;) {
+      // as in BookManager: after seeing the flag, anything still in the ring
+      // is the last of it
+      bool stopping = !running.load(std::memory_order_acquire);
+      // at most a ring's worth per commit, so a producer that never lets up
+      // still gets its records synced
+      while (batch.size() < max_batch) {
+        auto record = ring.pop();
+        if (!record)
+          break;
+        batch.push_back(*record);
+      }
+
+      if (!batch.empty() && healthy())
+        commit(batch);
+      batch.clear();
+
+      if (stopping && ring.size() == 0)
+        break;
+      if (!stopping)
+        std::this_thread::sleep_for(interval);
+    }
+  }
+
+  void commit(const std::vector<Record>& batch) {
+    const auto* bytes = reinterpret_cast<const char*>(batch.data());
+    size_t remaining = batch.size() * sizeof(Record);
+    while (remaining > 0) {
+      auto written = ::write(fd, bytes, remaining);
+      if (written < 0 && errno == EINTR)
+        continue;
+      if (written <= 0) {
+        failed.store(true, std::memory_order_release);
+        return;
+      }
+      bytes += written;
+      remaining -= static_cast<size_t>(written);
+    }
+
+    if (::fdatasync(fd) != 0) {
+      failed.store(true, std::memory_order_release);
+      return;
+    }
+    durable.fetch_add(batch.size(), std::memory_order_release);
+  }
+
+  int fd;
+  SpscCircularBuffer<Record> ring;
+  size_t max_batch;
+  std::chrono::microseconds interval;
+
+  uint64_t appended = 0;
+  uint64_t full_waits = 0;
+
+  std::atomic<uint64_t> durable{0};
+  std::atomic<bool> failed{false};
+  std::atomic<bool> running{true};
+  std::thread writer;
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// the log-linear bucketing behind both latency histograms, CycleHistogram
+// (book_stats.hpp) and HdrHistogram (order_flow_bench.hpp), so that the STATS
+// output and the bench report agree on what a percentile is
+//
+// values below 2 * sub_buckets get a bucket each. above that every power of
+// two is split into sub_buckets equal buckets, so a bucket's bound is within
+// 1 / sub_buckets of anything in it, over the whole uint64 range
+template <unsigned SubBits>
+struct LogLinearBuckets {
+  static constexpr size_t sub_buckets = size_t{1} << SubBits;
+  static constexpr size_t linear = 2 * sub_buckets;
+  static constexpr size_t count = linear + (63 - SubBits) * sub_buckets;
+
+  static size_t index_of(uint64_t value) noexcept {
+    if (value < linear)
+      return static_cast<size_t>(value);
+    auto shift = static_cast<size_t>(std::bit_width(value)) - (SubBits + 1);
+    auto mantissa = static_cast<size_t>(value >> shift); // in [sub, 2 * sub)
+    return linear + (shift - 1) * sub_buckets + (mantissa - sub_buckets);
+  }
+
+  static uint64_t highest_in(size_t idx) noexcept {
+    if (idx < linear)
+      return idx;
+    auto shift = (idx - linear) / sub_buckets + 1;
+    auto mantissa = (idx - linear) % sub_buckets + sub_buckets;
+    return ((uint64_t{mantissa} + 1) << shift) - 1;
+  }
+
+  // smallest bucket bound such that at least p of the samples are <= it,
+  // never more than the largest sample. 0 when nothing was recorded
+  static uint64_t percentile(std::span<const uint64_t, count> counts,
+                             uint64_t total, uint64_t max, double p) noexcept {
+    if (total == 0)
+      return 0;
+
+    auto target = std::max<uint64_t>(
+        1, static_cast<uint64_t>(std::ceil(p * static_cast<double>(total))));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+      seen += counts[i];
+      if (seen >= target)
+        return std::min(max, highest_in(i));
+    }
+    return max;
+  }
+};
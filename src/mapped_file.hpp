@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <fcntl.h>
+#include <span>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// read only mapping of a whole file, unmapped on destruction. binary feeds,
+// snapshots and journals are all arrays of fixed width records, so reading
+// them is a cast over the mapping rather than a parse
+//
+// an empty file is valid and has no bytes, as an empty feed is just one with
+// no records. mmap refuses a zero length mapping, so there's nothing mapped
+class MappedFile {
+public:
+  explicit MappedFile(const char* path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+
+    struct stat st{};
+    if (::fstat(fd, &st) == 0 && st.st_size == 0) {
+      opened = true;
+    } else if (st.st_size > 0) {
+      void* addr = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                          MAP_PRIVATE, fd, 0);
+      if (addr != MAP_FAILED) {
+        data = addr;
+        length = static_cast<size_t>(st.st_size);
+        opened = true;
+        ::madvise(data, length, MADV_SEQUENTIAL);
+      }
+    }
+    ::close(fd);
+  }
+
+  ~MappedFile() {
+    if (data)
+      ::munmap(data, length);
+  }
+
+  MappedFile(const MappedFile& other) = delete;
+  MappedFile& operator=(const MappedFile& other) = delete;
+
+  [[nodiscard]] bool valid() const noexcept { return opened; }
+  [[nodiscard]] size_t size() const noexcept { return length; }
+
+  [[nodiscard]] std::span<const std::byte> bytes() const noexcept {
+    return {static_cast<const std::byte*>(data), length};
+  }
+
+  // the file as an array of T, ignoring any trailing partial record. mmap
+  // hands back page aligned memory, so the cast is fine alignment wise
+  template <typename T>
+  [[nodiscard]] std::span<const T> as() const noexcept {
+    return {static_cast<const T*>(data), length / sizeof(T)};
+  }
+
+private:
+  void* data = nullptr;
+  size_t length = 0;
+  bool opened = false;
+};
@@ -1,8 +1,31 @@
+#include "basic_order_book.hpp"
+#include "book_side.hpp"
+#include "book_stats.hpp"
+#include "circular_buffer.hpp"
+#include "mapped_file.hpp"
+#include "order_flow_bench.hpp"
+#include "order_index.hpp"
+#include "seqlock.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
 #include <cstdint>
+#include <deque>
+#include <filesystem>
 #include <iostream>
-#include <list>
-#include <map>
+#include <limits>
+#include <optional>
+#include <pthread.h>
+#include <sched.h>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
+#include <vector>
 
 // an order book is required to support the following operations
 // - add_order(id, side, price, qty)
@@ -12,145 +35,412 @@
 // furthermore, we are required to implement price-time priority
 // aka best price trades, and first come first serve
 
-// ideally we'd get all three operations down to just O(1) using a *lot* of
-// pointers. if we're implementing these functions using STL containers and
-// iterators, the best we can achieve for add order is log n, delete order is
-// average case O(1) (unless we delete the level, in which case it's log n) and
-// modify order is O(1) or O(log n) depending on if the price is different
-// (since we delete + insert)
+// OrderBook is a BasicOrderBook (basic_order_book.hpp) put together for
+// feeds that only rest orders, never match them:
+// - each level is an intrusive doubly linked list of orders threaded through
+//   32 bit handles into one pooled slab (PooledLevels). freed nodes are
+//   reused, so add/delete/modify don't touch malloc once the slab has grown to
+//   the peak number of live orders
+// - the sides are BookSides over a PriceLadder (book_side.hpp,
+//   price_ladder.hpp): a flat array of levels over a window of ticks plus an
+//   occupancy bitmap, with a tree only for prices outside the window. a price
+//   finds its level by indexing, and the best price is cached
+// - id -> order is a FlatOrderIndex (order_index.hpp), a direct window for
+//   dense increasing exchange ids backed by a robin hood table, so a cancel is
+//   usually one array access
 //
-// note from future uzman: you can get O(1) average add by just having a map of
-// price to level iterator!!
+// a quantity only modify keeps the order's place on a reduction and sends it
+// to the back of its level on an increase, and reduce_order is the exchange
+// style partial cancel. a price change is a delete + add
 //
-// we have one order book per symbol. each order book maintains two std::map's,
-// from a given price level to a structure that holds doubly linked lists
-// representing individual orders
+// on top of the core, OrderBook plugs in a level hook that emits BookEvents
+// (level and bbo deltas) into an SPSC ring for subscribers, and counts level
+// creates / erases for `make STATS=1`, which also records per operation cycle
+// histograms and index probe lengths (book_stats.hpp). other threads read the
+// top levels through a Seqlock'd DepthSnapshot published after every
+// apply_batch, and stats() is the one method that's safe to call while the
+// book is being mutated
 //
-// why a doubly linked list? because we'd want to have iterator stability to
-// support deletion. deletion is accomplished using an unordered_map from order
-// id to an OrderPtr struct - containing an *iterator* to a node in our doubly
-// linked list as well as an iterator the containing price level
+// LevelBook is for consumers that only want price levels: total quantity and
+// order count per price, no orders and no id index, each side a sorted vector
+// (FlatSide). it takes level updates directly, including an OrderBook's
+// events, and answers get_bbo / top_n the same way. a symbol with a few dozen
+// levels costs under a kilobyte, against hundreds of kilobytes of ladders,
+// pool and index for an OrderBook
 //
-// and with that, we should have a pretty robust orderbook that definitely has
-// some room for improvement, but suffices for interview settings
+// BookManager runs one OrderBook per symbol, sharded over pinned worker
+// threads that each own their books outright
 
 using OrderId = uint64_t;
 using Price = uint32_t;
-struct Order {
+
+// wire format of a single book mutation, one per add_order / delete_order /
+// modify_order call. used by the binary feed replay, apply_batch and the book
+// manager
+enum class MsgType : uint8_t { Add = 0, Delete = 1, Modify = 2 };
+
+// 24 bytes, laid out so that every field is naturally aligned. fields that an
+// operation doesn't use (eg price on delete) are ignored. records are read
+// straight out of a file, so the side is a plain byte (1 bid, 0 ask) rather
+// than a bool, and apply() rejects anything else, like an unknown type
+struct FeedMsg {
   OrderId id;
-  bool is_bid;
   Price price;
   uint32_t qty;
+  MsgType type;
+  uint8_t is_bid;
+  uint8_t padding[6];
 };
+static_assert(sizeof(FeedMsg) == 24);
+static_assert(std::is_trivially_copyable_v<FeedMsg>);
+
+// one row of an L2 (market by price) snapshot
+using LevelSummary = BasicLevelSummary<Price>;
 
-// could make this a struct and track per level aggregrates such as total qty
-// and num orders
-using Level = std::list<Order>;
+// top of book, n levels deep, as published to other threads. levels are best
+// first, and the first level of each side is what get_bbo() would return
+template <size_t N>
+struct DepthSnapshot {
+  uint64_t version = 0; // number of publishes so far, including this one
+  uint32_t num_bids = 0;
+  uint32_t num_asks = 0;
+  std::array<LevelSummary, N> bids{};
+  std::array<LevelSummary, N> asks{};
 
-struct OrderPtr {
-  std::map<Price, Level>::iterator level_it;
-  std::list<Order>::iterator order_it;
-  bool is_bid;
+  // same convention as OrderBook::get_bbo, -1 for an empty side
+  [[nodiscard]] std::pair<int, int> bbo() const noexcept {
+    return {num_bids ? static_cast<int>(bids[0].price) : -1,
+            num_asks ? static_cast<int>(asks[0].price) : -1};
+  }
 };
 
-class OrderBook {
+inline constexpr size_t published_levels = 10;
+using PublishedDepth = Seqlock<DepthSnapshot<published_levels>>;
+
+// incremental market data. every mutation describes its effect on the level it
+// touched, with the level's aggregates after the change (zeros for a removal),
+// plus a BboChanged whenever the best prices move. a publisher can forward
+// these as they come instead of diffing snapshots
+enum class EventType : uint8_t {
+  LevelAdded,
+  LevelChanged,
+  LevelRemoved,
+  BboChanged
+};
+
+inline constexpr Price no_price = std::numeric_limits<Price>::max();
+
+struct BookEvent {
+  EventType type;
+  bool is_bid; // level events only
+  uint32_t num_orders;
+  Price price;     // level price, or the best bid for BboChanged
+  Price ask_price; // BboChanged only, no_price for an empty side
+  uint64_t total_qty;
+};
+static_assert(sizeof(BookEvent) == 24);
+
+// what OrderBook plugs into BasicOrderBook's level hook: the level events for
+// a subscriber, and level create / erase counts for STATS=1. a level with no
+// quantity before the change is new, one with no orders after it is going
+class OrderBookHooks {
 public:
-  // rule of zero, no management of any resources woo!
-  OrderBook() {}
+  OrderBookHooks(Price /*tick*/, size_t /*num_ticks*/) noexcept {}
 
-  void add_order(OrderId id, bool is_bid, Price price, uint32_t qty) {
-    if (orders.find(id) != orders.end()) {
+  template <Side S>
+  void level_changed(Price price, uint64_t before, uint64_t total_qty,
+                     uint32_t num_orders) {
+    if (before == 0)
+      stats.level_created();
+    if (num_orders == 0)
+      stats.level_erased();
+    if (!events)
       return;
-    }
+    push(BookEvent{.type = before == 0       ? EventType::LevelAdded
+                           : num_orders == 0 ? EventType::LevelRemoved
+                                             : EventType::LevelChanged,
+                   .is_bid = S == Side::Bid,
+                   .num_orders = num_orders,
+                   .price = price,
+                   .ask_price = no_price,
+                   .total_qty = total_qty});
+  }
+
+  void push(const BookEvent& event) {
+    if (!events->push(event))
+      ++events_dropped;
+  }
 
-    auto order = Order{.id = id, .is_bid = is_bid, .price = price, .qty = qty};
+  SpscCircularBuffer<BookEvent>* events = nullptr;
+  uint64_t events_dropped = 0;
+  [[no_unique_address]] BookStats stats;
+};
 
-    auto& side = is_bid ? bids : asks;
-    auto [level, _] = side.try_emplace(price);
-    level->second.push_back(order);
-    orders[id] = OrderPtr{.level_it = level,
-                          .order_it = std::prev(level->second.end()),
-                          .is_bid = is_bid};
+class OrderBook {
+public:
+  explicit OrderBook(size_t capacity_hint = 1024, Price tick = 1,
+                     size_t num_ticks = 4096)
+      : book(capacity_hint, tick, num_ticks) {}
+
+  // ignored for a duplicate id, or once the pool holds max_orders
+  void add_order(OrderId id, bool is_bid, Price price, uint32_t qty) {
+    BookStats::Timer timer(op_stats(), StatOp::Add);
+    record_probe(id);
+    book.add_order(id, is_bid, price, qty);
+    publish_bbo();
   }
 
   void delete_order(OrderId id) {
-    auto it = orders.find(id);
-    if (it == orders.end()) {
-      return;
-    }
+    BookStats::Timer timer(op_stats(), StatOp::Delete);
+    record_probe(id);
+    book.delete_order(id);
+    publish_bbo();
+  }
 
-    auto& level_it = it->second.level_it;
-    auto& order_it = it->second.order_it;
-    auto& is_bid = it->second.is_bid;
-    level_it->second.erase(order_it);
-    if (level_it->second.empty()) {
-      is_bid ? bids.erase(level_it) : asks.erase(level_it);
+  // a price change is treated as a new order (ie delete + add). at the same
+  // price, a smaller quantity keeps priority and a larger one loses it
+  void modify_order(OrderId id, Price new_price, uint32_t new_qty) {
+    BookStats::Timer timer(op_stats(), StatOp::Modify);
+    record_probe(id);
+    // NIT: new_qty = 0 is essentially a delete
+    if (new_qty == 0) {
+      book.delete_order(id);
+    } else {
+      book.modify_order(id, new_price, new_qty);
     }
-    orders.erase(it);
+    publish_bbo();
   }
 
-  void modify_order(OrderId id, Price new_price, uint32_t new_qty) {
-    // let's say for example's sake that if price is the same, then the order
-    // maintains priority, else it's treated as a new order (ie delete + add)
+  // cancels part of an order, keeping its priority. reducing by the whole
+  // remaining quantity (or more) deletes it
+  void reduce_order(OrderId id, uint32_t reduce_by) {
+    BookStats::Timer timer(op_stats(), StatOp::Modify);
+    record_probe(id);
+    book.reduce_order(id, reduce_by);
+    publish_bbo();
+  }
 
-    auto it = orders.find(id);
-    if (it == orders.end()) {
-      return;
-    }
+  // mutations push level/bbo deltas into sink from now on. pass nullptr to
+  // stop. if the consumer falls behind and the ring fills up, events are
+  // dropped and counted, and the consumer should resync from top_n
+  void set_event_sink(SpscCircularBuffer<BookEvent>* sink) noexcept {
+    book.hooks().events = sink;
+    last_bbo = get_bbo();
+  }
 
-    auto& order_it = it->second.order_it;
-    // NIT: new_qty = 0 is essentially a delete
-    if (new_qty == 0) {
-      delete_order(order_it->id);
+  [[nodiscard]] uint64_t dropped_events() const noexcept {
+    return book.hooks().events_dropped;
+  }
+
+  // every apply_batch publishes the top published_levels levels of both sides
+  // to depth from now on. nullptr stops it
+  void set_depth_publisher(PublishedDepth* depth) {
+    published = depth;
+    publish_depth();
+  }
+
+  // for callers driving the book one operation at a time, publishes now
+  void publish_depth() {
+    if (!published)
       return;
-    }
+    DepthSnapshot<published_levels> snapshot;
+    snapshot.version = published->version() + 1;
+    snapshot.num_bids = static_cast<uint32_t>(
+        top_n(true, published_levels, snapshot.bids));
+    snapshot.num_asks = static_cast<uint32_t>(
+        top_n(false, published_levels, snapshot.asks));
+    published->store(snapshot);
+  }
 
-    if (order_it->qty != new_qty) {
-      order_it->qty = new_qty;
+  // all zeros unless built with STATS=1. safe to call from any thread
+  [[nodiscard]] BookStatsSnapshot stats() const noexcept {
+    return book.hooks().stats.snapshot();
+  }
+
+  // false for a malformed message (a side byte other than 0 or 1, or an
+  // unknown type), which leaves the book untouched
+  bool apply(const FeedMsg& msg) {
+    if (msg.is_bid > 1)
+      return false;
+    switch (msg.type) {
+      case MsgType::Add:
+        add_order(msg.id, msg.is_bid == 1, msg.price, msg.qty);
+        return true;
+      case MsgType::Delete:
+        delete_order(msg.id);
+        return true;
+      case MsgType::Modify:
+        modify_order(msg.id, msg.price, msg.qty);
+        return true;
     }
+    return false;
+  }
+
+  // same result as calling apply() on each message in order, but software
+  // pipelined so the cache misses of later messages overlap with the work on
+  // the current one:
+  // - 16 ahead: prefetch the id's index slot, and for adds/modifies the level
+  //   at the message's price
+  // - 8 ahead: the index slot should be in cache now, so look the id up and
+  //   prefetch its order node
+  // - 4 ahead: the node should be in cache, prefetch the level a delete will
+  //   unlink from
+  // lookups made ahead of time are only ever used as prefetch hints, so it
+  // doesn't matter if an earlier message in the batch changes them (or that
+  // the message turns out to be malformed). returns the number of malformed
+  // messages skipped
+  size_t apply_batch(std::span<const FeedMsg> msgs) {
+    constexpr size_t index_distance = 16;
+    constexpr size_t node_distance = 8;
+    constexpr size_t level_distance = 4;
 
-    if (it->second.order_it->price != new_price) {
-      Order order{.id = order_it->id,
-                  .is_bid = order_it->is_bid,
-                  .price = new_price,
-                  .qty = order_it->qty};
-      delete_order(order.id);
-      add_order(order.id, order.is_bid, order.price, order.qty);
+    size_t malformed = 0;
+    for (size_t i = 0; i < msgs.size(); ++i) {
+      if (i + index_distance < msgs.size()) {
+        const auto& ahead = msgs[i + index_distance];
+        book.prefetch_id(ahead.id);
+        if (ahead.type != MsgType::Delete)
+          book.prefetch_level(ahead.is_bid, ahead.price);
+      }
+      if (i + node_distance < msgs.size()) {
+        const auto& ahead = msgs[i + node_distance];
+        if (ahead.type != MsgType::Add)
+          book.prefetch_order(ahead.id);
+      }
+      if (i + level_distance < msgs.size()) {
+        const auto& ahead = msgs[i + level_distance];
+        if (ahead.type == MsgType::Delete)
+          book.prefetch_order_level(ahead.id);
+      }
+      if (!apply(msgs[i]))
+        ++malformed;
     }
+    publish_depth();
+    return malformed;
   }
 
   [[nodiscard]] std::pair<int, int> get_bbo() const noexcept {
-    auto best_bid = bids.empty() ? -1 : bids.rbegin()->first;
-    auto best_ask = asks.empty() ? -1 : asks.begin()->first;
-    return {best_bid, best_ask};
+    auto best_bid = book.best_bid();
+    auto best_ask = book.best_ask();
+    return {best_bid ? static_cast<int>(*best_bid) : -1,
+            best_ask ? static_cast<int>(*best_ask) : -1};
+  }
+
+  // fills out with up to n levels from the best price outwards, using only the
+  // per level aggregates. returns the number of levels written
+  size_t top_n(bool is_bid, size_t n, std::span<LevelSummary> out) const {
+    return book.top_n(is_bid, n, out);
   }
 
   friend std::ostream& operator<<(std::ostream& os, const OrderBook& book) {
-    os << "====================\n";
-    for (auto level_it = book.asks.rbegin(); level_it != book.asks.rend();
-         ++level_it) {
-      os << "ask: $" << level_it->first << " | ";
-      for (auto order_it = level_it->second.begin();
-           order_it != level_it->second.end();) {
-        os << "{ id: " << order_it->id << " , qty: " << order_it->qty << " }";
-        if (++order_it != level_it->second.end())
-          os << " -> ";
+    return os << book.book;
+  }
+
+private:
+  // orders as pooled 24 byte nodes, a ladder per side, and no matching: this
+  // book follows a venue's feed, which reports trades as deletes and modifies
+  using Core = BasicOrderBook<PooledLevels, FlatIndex,
+                              LadderPrices<Price, uint32_t>, RestOnly,
+                              OrderBookHooks>;
+
+  [[nodiscard]] BookStats& op_stats() noexcept { return book.hooks().stats; }
+
+  // counts the probes with a lookup of its own, so only when stats are
+  // compiled in. it runs inside the timed region, and warms the index slots
+  // for the real lookup that follows
+  void record_probe(OrderId id) noexcept {
+    if constexpr (book_stats_enabled)
+      op_stats().probe(book.probe_length(id));
+  }
+
+  // bbo only moves when a level appears or disappears, so this is called once
+  // at the end of every public operation rather than per level event. that
+  // way a reprice (remove + insert) never publishes an intermediate bbo
+  void publish_bbo() {
+    if (!book.hooks().events)
+      return;
+    auto bbo = get_bbo();
+    if (bbo == last_bbo)
+      return;
+    last_bbo = bbo;
+    auto to_price = [](int price) {
+      return price < 0 ? no_price : static_cast<Price>(price);
+    };
+    book.hooks().push(BookEvent{.type = EventType::BboChanged,
+                                .is_bid = false,
+                                .num_orders = 0,
+                                .price = to_price(bbo.first),
+                                .ask_price = to_price(bbo.second),
+                                .total_qty = 0});
+  }
+
+  Core book;
+
+  std::pair<int, int> last_bbo{-1, -1};
+  PublishedDepth* published = nullptr;
+};
+
+// market by price: a level's aggregates are all there is, so an update just
+// overwrites them
+struct LevelTotals {
+  uint64_t total_qty = 0;
+  uint32_t num_orders = 0;
+};
+
+class LevelBook {
+public:
+  // sets a level as an L2 feed reports it. zero quantity removes the level
+  void update_level(bool is_bid, Price price, uint64_t total_qty,
+                    uint32_t num_orders) {
+    visit_side(side_of(is_bid), bids, asks, [&](auto& side) {
+      if (total_qty == 0) {
+        side.erase(price);
+        return;
       }
-      os << "\n";
+      side.emplace(price) = LevelTotals{total_qty, num_orders};
+    });
+  }
+
+  // level events carry the level's totals after the change, so an OrderBook's
+  // event stream drives a LevelBook as is. bbo events are implied by the
+  // levels and ignored
+  void apply(const BookEvent& event) {
+    if (event.type == EventType::BboChanged)
+      return;
+    update_level(event.is_bid, event.price, event.total_qty, event.num_orders);
+  }
+
+  [[nodiscard]] std::pair<int, int> get_bbo() const noexcept {
+    auto best_bid = bids.best();
+    auto best_ask = asks.best();
+    return {best_bid ? static_cast<int>(*best_bid) : -1,
+            best_ask ? static_cast<int>(*best_ask) : -1};
+  }
+
+  // same as OrderBook::top_n
+  size_t top_n(bool is_bid, size_t n, std::span<LevelSummary> out) const {
+    return visit_side(side_of(is_bid), bids, asks, [&](const auto& side) {
+      return top_levels(side, n, out);
+    });
+  }
+
+  // the whole book, levels included
+  [[nodiscard]] size_t memory_usage() const noexcept {
+    return sizeof(LevelBook) + bids.memory_usage() + asks.memory_usage();
+  }
+
+  friend std::ostream& operator<<(std::ostream& os, const LevelBook& book) {
+    os << "====================\n";
+    for (auto price = book.asks.worst(); price;
+         price = book.asks.next_better(*price)) {
+      print_level(os << "ask: $", *price, *book.asks.find(*price));
     }
 
     os << "\n";
 
-    for (auto level_it = book.bids.rbegin(); level_it != book.bids.rend();
-         ++level_it) {
-      os << "bid: $" << level_it->first << " | ";
-      for (auto order_it = level_it->second.begin();
-           order_it != level_it->second.end();) {
-        os << "{ id: " << order_it->id << " , qty: " << order_it->qty << " }";
-        if (++order_it != level_it->second.end())
-          os << " -> ";
-      }
-      os << "\n";
+    for (auto price = book.bids.best(); price;
+         price = book.bids.next_worse(*price)) {
+      print_level(os << "bid: $", *price, *book.bids.find(*price));
     }
     os << "====================";
 
@@ -158,14 +448,252 @@ public:
   }
 
 private:
-  // note, we need to treat any ordered operation on asks as reversed
-  std::map<Price, Level> bids;
-  std::map<Price, Level> asks;
+  static void print_level(std::ostream& os, Price price,
+                          const LevelTotals& level) {
+    os << price << " | " << level.total_qty << " (" << level.num_orders
+       << ")\n";
+  }
 
-  std::unordered_map<OrderId, OrderPtr> orders;
+  FlatSide<Side::Bid, Price, LevelTotals> bids{1, 0};
+  FlatSide<Side::Ask, Price, LevelTotals> asks{1, 0};
 };
 
-int main() {
+void print_stats(const BookStatsSnapshot& stats) {
+  constexpr const char* names[] = {"add", "delete", "modify"};
+  std::cout << "cycles:\n";
+  for (size_t op = 0; op < stat_op_count; ++op) {
+    const auto& hist = stats.cycles[op];
+    std::cout << "  " << names[op] << ": " << hist.total << " ops, p50 "
+              << hist.percentile(0.5) << ", p99 " << hist.percentile(0.99)
+              << ", p99.9 " << hist.percentile(0.999) << ", max " << hist.max
+              << "\n";
+  }
+  std::cout << "levels:     " << stats.levels_created << " created, "
+            << stats.levels_erased << " erased\n"
+            << "probes:    ";
+  for (size_t i = 0; i < probe_buckets; ++i) {
+    if (stats.probes[i] != 0)
+      std::cout << " " << i << (i + 1 == probe_buckets ? "+" : "") << ":"
+                << stats.probes[i];
+  }
+  std::cout << "\n";
+}
+
+// replaying a binary feed: `./build/order_book replay feed.bin [batch]`
+//
+// the file is just an array of fixed width FeedMsg records. we mmap it and
+// hand the book a span over the mapping, so decoding is a pointer cast and
+// nothing gets copied
+
+// with batch > 1 the feed is applied through apply_batch in chunks of that
+// size, and every message in a chunk is charged the chunk's average latency
+//
+// the book is sized for half the messages resting at once. that's only an
+// upper bound, but the pool just reserves address space for it and the id
+// index caps its own window
+
+int replay(const char* path, size_t batch) {
+  // an empty feed can't be mapped, and has no throughput or latencies to
+  // report anyway
+  std::error_code error;
+  if (std::filesystem::file_size(path, error) == 0 && !error) {
+    std::cout << "messages:   0, nothing to replay\n";
+    return 0;
+  }
+
+  MappedFile feed(path);
+  if (!feed.valid() || feed.size() % sizeof(FeedMsg) != 0) {
+    std::cerr << "could not map " << path << " as a feed file\n";
+    return 1;
+  }
+
+  auto msgs = feed.as<FeedMsg>();
+  OrderBook book(msgs.size() / 2 + 1);
+  HdrHistogram latency;
+
+  using clock = std::chrono::steady_clock;
+  size_t malformed = 0;
+  auto start = clock::now();
+  for (size_t i = 0; i < msgs.size(); i += batch) {
+    auto chunk = msgs.subspan(i, std::min(batch, msgs.size() - i));
+    auto before = clock::now();
+    if (batch == 1) {
+      malformed += !book.apply(chunk[0]);
+    } else {
+      malformed += book.apply_batch(chunk);
+    }
+    auto elapsed = clock::now() - before;
+    auto ns = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    for (size_t j = 0; j < chunk.size(); ++j)
+      latency.record(ns / chunk.size());
+  }
+  auto total = std::chrono::duration<double>(clock::now() - start).count();
+
+  std::cout << "messages:   " << msgs.size() << "\n"
+            << "elapsed:    " << total << " s\n"
+            << "throughput: " << static_cast<double>(msgs.size()) / total
+            << " msgs/s\n"
+            << "latency ns: p50 " << latency.percentile(0.5) << ", p99 "
+            << latency.percentile(0.99) << ", p99.9 "
+            << latency.percentile(0.999) << ", max " << latency.maximum()
+            << "\n"
+            << "final bbo:  " << book.get_bbo().first << " "
+            << book.get_bbo().second << "\n";
+  if (malformed)
+    std::cout << "malformed:  " << malformed << " messages skipped\n";
+  if constexpr (book_stats_enabled)
+    print_stats(book.stats());
+  return 0;
+}
+
+// one order book per symbol means a feed handler has to own thousands of them.
+// BookManager splits the symbol universe into shards, each with a worker
+// thread pinned to its own core that owns its books outright, so the books need
+// no locking at all. messages reach a shard through its SPSC ring, with the
+// feed handler thread as the single producer for every ring
+
+using SymbolId = uint32_t;
+
+struct SymbolMsg {
+  SymbolId symbol;
+  FeedMsg msg;
+};
+
+class BookManager {
+public:
+  // num_shards of 0 is taken as 1, shard_of needs something to divide by
+  BookManager(size_t num_shards, size_t queue_capacity = 65536,
+              size_t book_capacity_hint = 256, Price tick = 1,
+              size_t num_ticks = 512)
+      : book_config{book_capacity_hint, tick, num_ticks} {
+    num_shards = std::max<size_t>(num_shards, 1);
+    auto num_cpus = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < num_shards; ++i) {
+      shards.emplace_back(queue_capacity);
+    }
+    for (size_t i = 0; i < num_shards; ++i) {
+      shards[i].worker = std::thread(&BookManager::run, this,
+                                     std::ref(shards[i]), i % num_cpus);
+    }
+  }
+
+  ~BookManager() { stop(); }
+
+  // owns running threads that point back at us
+  BookManager(const BookManager& other) = delete;
+  BookManager& operator=(const BookManager& other) = delete;
+
+  // feed handler thread only. returns false if the shard's ring is full, in
+  // which case the caller decides whether to spin or drop
+  bool submit(SymbolId symbol, const FeedMsg& msg) {
+    return shards[shard_of(symbol)].queue.push(SymbolMsg{symbol, msg});
+  }
+
+  // called from the feed handler thread once it's done submitting. workers
+  // drain whatever is left in their rings before exiting
+  void stop() {
+    running.store(false, std::memory_order_release);
+    for (auto& shard : shards) {
+      if (shard.worker.joinable())
+        shard.worker.join();
+    }
+  }
+
+  // books are owned by the workers, so this is only safe after stop()
+  [[nodiscard]] const OrderBook* book(SymbolId symbol) const {
+    const auto& books = shards[shard_of(symbol)].books;
+    auto it = books.find(symbol);
+    return it == books.end() ? nullptr : &it->second;
+  }
+
+  // fibonacci hashing, so that runs of sequential symbol ids still spread
+  // evenly over the shards
+  [[nodiscard]] size_t shard_of(SymbolId symbol) const noexcept {
+    return static_cast<size_t>((symbol * 0x9E3779B97F4A7C15ull) >> 32) %
+           shards.size();
+  }
+
+private:
+  struct Shard {
+    explicit Shard(size_t queue_capacity) : queue(queue_capacity) {}
+
+    SpscCircularBuffer<SymbolMsg> queue;
+    std::unordered_map<SymbolId, OrderBook> books;
+    std::thread worker;
+  };
+
+  void run(Shard& shard, size_t cpu) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+    for (;;) {
+      // read the flag before popping: once stop() has been seen, every push
+      // the producer made is visible, so an empty ring really means done
+      bool stopping = !running.load(std::memory_order_acquire);
+      if (auto msg = shard.queue.pop()) {
+        auto [book, _] = shard.books.try_emplace(
+            msg->symbol, book_config.capacity_hint, book_config.tick,
+            book_config.num_ticks);
+        // a malformed message is dropped, the feed handler validates its
+        // input before it gets this far
+        book->second.apply(msg->msg);
+        continue;
+      }
+      if (stopping)
+        break;
+      std::this_thread::yield();
+    }
+  }
+
+  // constructor arguments for every book the workers create
+  struct BookConfig {
+    size_t capacity_hint;
+    Price tick;
+    size_t num_ticks;
+  } book_config;
+
+  // deque so shards never move once their worker holds a reference
+  std::deque<Shard> shards;
+  std::atomic<bool> running{true};
+};
+
+// order flow benchmark: `./build/order_book bench ops=... cancel=...`, see
+// order_flow_bench.hpp
+struct OrderBookBench {
+  OrderBook book;
+
+  void add(uint64_t id, bool is_bid, uint64_t price, uint64_t qty) {
+    book.add_order(id, is_bid, static_cast<Price>(price),
+                   static_cast<uint32_t>(qty));
+  }
+  void remove(uint64_t id) { book.delete_order(id); }
+  void modify(uint64_t id, uint64_t price, uint64_t qty) {
+    book.modify_order(id, static_cast<Price>(price),
+                      static_cast<uint32_t>(qty));
+  }
+};
+
+int main(int argc, char** argv) {
+  if ((argc == 3 || argc == 4) && std::string_view(argv[1]) == "replay") {
+    auto batch = argc == 4 ? parse_count(argv[3]) : 1;
+    if (!batch) {
+      std::cerr << "usage: order_book replay feed.bin [batch]\n";
+      return 1;
+    }
+    return replay(argv[2], std::max<size_t>(1, *batch));
+  }
+  if (argc >= 2 && std::string_view(argv[1]) == "bench") {
+    auto config = parse_bench_args(std::span(argv + 2, argv + argc));
+    if (!config) {
+      std::cerr << "usage: order_book bench " << bench_options << "\n";
+      return 1;
+    }
+    OrderBookBench bench{OrderBook(config->depth * 2)};
+    return run_bench("OrderBook", bench, *config);
+  }
 
   OrderBook book;
 
@@ -198,6 +726,285 @@ int main() {
   // output: 10 15
   std::cout << book.get_bbo().first << " " << book.get_bbo().second << "\n";
 
+  // unlinking from the middle of a level, then reusing the freed node
+  book.add_order(9, true, 5, 7);
+  book.delete_order(6);
+  book.add_order(10, true, 5, 3);
+  // output: bid: $5 | { id: 5 , qty: 1 } -> { id: 9 , qty: 7 } -> { id: 10 ,
+  // qty: 3 }
+  std::cout << book << "\n";
+
+  // L2 snapshot straight from the level aggregates
+  book.modify_order(9, 5, 2);
+  std::array<LevelSummary, 2> depth{};
+  auto num_levels = book.top_n(true, 5, depth);
+  // output: 10 x 10 (1)
+  //         9 x 8 (1)
+  for (size_t i = 0; i < num_levels; ++i) {
+    std::cout << depth[i].price << " x " << depth[i].total_qty << " ("
+              << depth[i].num_orders << ")\n";
+  }
+  book.delete_order(3);
+  book.delete_order(4);
+  book.top_n(true, 1, depth);
+  // output: 5 x 6 (3)
+  std::cout << depth[0].price << " x " << depth[0].total_qty << " ("
+            << depth[0].num_orders << ")\n";
+  book.top_n(false, 1, depth);
+  // output: 15 x 5 (1)
+  std::cout << depth[0].price << " x " << depth[0].total_qty << " ("
+            << depth[0].num_orders << ")\n";
+
+  // increasing an order's quantity sends it to the back of its level, reducing
+  // it (here by a partial cancel) keeps its place
+  book.modify_order(5, 5, 4);
+  book.reduce_order(9, 1);
+  // output: bid: $5 | { id: 9 , qty: 1 } -> { id: 10 , qty: 3 } -> { id: 5 ,
+  // qty: 4 }
+  std::cout << book << "\n";
+  book.reduce_order(9, 5);
+  // output: 5 15
+  std::cout << book.get_bbo().first << " " << book.get_bbo().second << "\n";
+
+  // apply_batch ends up in the same state as applying one message at a time
+  {
+    std::vector<FeedMsg> msgs;
+    for (uint32_t i = 0; i < 64; ++i) {
+      msgs.push_back(FeedMsg{.id = i,
+                             .price = 100 + i % 8,
+                             .qty = i + 1,
+                             .type = MsgType::Add,
+                             .is_bid = i % 2 == 0,
+                             .padding = {}});
+    }
+    for (uint32_t i = 0; i < 64; i += 3) {
+      msgs.push_back(FeedMsg{.id = i,
+                             .price = 0,
+                             .qty = 0,
+                             .type = MsgType::Delete,
+                             .is_bid = false,
+                             .padding = {}});
+    }
+    OrderBook one_by_one;
+    OrderBook batched;
+    for (const auto& msg : msgs)
+      one_by_one.apply(msg);
+    batched.apply_batch(msgs);
+
+    std::array<LevelSummary, 8> expected{};
+    std::array<LevelSummary, 8> actual{};
+    bool same = true;
+    for (bool is_bid : {true, false}) {
+      auto n = one_by_one.top_n(is_bid, 8, expected);
+      same &= batched.top_n(is_bid, 8, actual) == n;
+      for (size_t i = 0; i < n; ++i) {
+        same &= expected[i].price == actual[i].price &&
+                expected[i].total_qty == actual[i].total_qty &&
+                expected[i].num_orders == actual[i].num_orders;
+      }
+    }
+    // output: true
+    std::cout << std::boolalpha << same << std::noboolalpha << "\n";
+  }
+
+  // delta events instead of snapshots
+  {
+    SpscCircularBuffer<BookEvent> events(64);
+    OrderBook live;
+    live.set_event_sink(&events);
+    live.add_order(1, true, 10, 5);
+    live.add_order(2, true, 10, 7);
+    live.modify_order(2, 10, 3);
+    live.add_order(3, false, 12, 4);
+    live.delete_order(1);
+    live.modify_order(3, 11, 4);
+
+    // output:
+    // added bid 10 x 5 (1) | bbo 10 - | changed bid 10 x 12 (2) |
+    // changed bid 10 x 8 (2) | added ask 12 x 4 (1) | bbo 10 12 |
+    // changed bid 10 x 3 (1) | removed ask 12 x 0 (0) | added ask 11 x 4 (1) |
+    // bbo 10 11 |
+    constexpr const char* names[] = {"added", "changed", "removed"};
+    while (auto event = events.pop()) {
+      if (event->type == EventType::BboChanged) {
+        auto show = [](Price price) {
+          return price == no_price ? std::string("-") : std::to_string(price);
+        };
+        std::cout << "bbo " << show(event->price) << " "
+                  << show(event->ask_price) << " | ";
+      } else {
+        std::cout << names[static_cast<size_t>(event->type)] << " "
+                  << (event->is_bid ? "bid " : "ask ") << event->price << " x "
+                  << event->total_qty << " (" << event->num_orders << ") | ";
+      }
+    }
+    std::cout << "\n";
+  }
+
+  // depth read from another thread while the book is being updated. every
+  // batch sets the best bid and best ask to the same quantity, so a snapshot
+  // where the two differ would be a torn read
+  {
+    PublishedDepth shared_depth;
+    OrderBook book_under_load;
+    book_under_load.add_order(1, true, 99, 1);
+    book_under_load.add_order(2, false, 101, 1);
+    book_under_load.add_order(3, true, 98, 50);
+    book_under_load.set_depth_publisher(&shared_depth);
+
+    constexpr uint32_t batches = 20000;
+    std::thread reader([&shared_depth] {
+      uint64_t torn = 0;
+      for (;;) {
+        auto snapshot = shared_depth.load();
+        if (snapshot.bids[0].total_qty != snapshot.asks[0].total_qty)
+          ++torn;
+        if (snapshot.bids[0].total_qty == batches) {
+          // output: 0 torn, 2 bid levels, bbo 99 101
+          std::cout << torn << " torn, " << snapshot.num_bids
+                    << " bid levels, bbo " << snapshot.bbo().first << " "
+                    << snapshot.bbo().second << "\n";
+          return;
+        }
+      }
+    });
+
+    for (uint32_t qty = 2; qty <= batches; ++qty) {
+      std::array<FeedMsg, 2> batch{};
+      batch[0] = FeedMsg{.id = 1,
+                         .price = 99,
+                         .qty = qty,
+                         .type = MsgType::Modify,
+                         .is_bid = true,
+                         .padding = {}};
+      batch[1] = FeedMsg{.id = 2,
+                         .price = 101,
+                         .qty = qty,
+                         .type = MsgType::Modify,
+                         .is_bid = false,
+                         .padding = {}};
+      book_under_load.apply_batch(batch);
+    }
+    reader.join();
+  }
+
+  // a LevelBook kept in step with an OrderBook through its level events ends
+  // up with the same depth, at a fraction of the memory
+  {
+    SpscCircularBuffer<BookEvent> events(256);
+    OrderBook full;
+    LevelBook levels;
+    full.set_event_sink(&events);
+    for (uint32_t i = 0; i < 40; ++i)
+      full.add_order(i, i % 2 == 0, i % 2 == 0 ? 90 + i % 7 : 100 + i % 9,
+                     i + 1);
+    full.modify_order(4, 95, 50);
+    full.reduce_order(7, 3);
+    full.delete_order(10);
+    full.delete_order(24);
+    while (auto event = events.pop())
+      levels.apply(*event);
+
+    std::array<LevelSummary, 16> expected{};
+    std::array<LevelSummary, 16> actual{};
+    bool same = levels.get_bbo() == full.get_bbo();
+    for (bool is_bid : {true, false}) {
+      auto n = full.top_n(is_bid, 16, expected);
+      same &= levels.top_n(is_bid, 16, actual) == n;
+      for (size_t i = 0; i < n; ++i) {
+        same &= expected[i].price == actual[i].price &&
+                expected[i].total_qty == actual[i].total_qty &&
+                expected[i].num_orders == actual[i].num_orders;
+      }
+    }
+    // output: true 96 100
+    std::cout << std::boolalpha << same << std::noboolalpha << " "
+              << levels.get_bbo().first << " " << levels.get_bbo().second
+              << "\n";
+
+    // an L2 feed talks in levels directly
+    levels.update_level(true, 96, 0, 0);
+    levels.update_level(false, 99, 15, 2);
+    // output: 95 99
+    std::cout << levels.get_bbo().first << " " << levels.get_bbo().second
+              << "\n";
+    // output: 564 bytes (for 16 levels)
+    std::cout << levels.memory_usage() << " bytes\n";
+  }
+
+  // four symbols spread over two shards. each symbol gets a bid at 100 + id
+  // and an ask at 200 + id, then symbol 3 loses its bid
+  {
+    BookManager manager(2);
+    OrderId id = 0;
+    for (SymbolId symbol = 1; symbol <= 4; ++symbol) {
+      manager.submit(symbol, FeedMsg{.id = ++id,
+                                     .price = 100 + symbol,
+                                     .qty = 10,
+                                     .type = MsgType::Add,
+                                     .is_bid = true,
+                                     .padding = {}});
+      manager.submit(symbol, FeedMsg{.id = ++id,
+                                     .price = 200 + symbol,
+                                     .qty = 10,
+                                     .type = MsgType::Add,
+                                     .is_bid = false,
+                                     .padding = {}});
+    }
+    manager.submit(3, FeedMsg{.id = 5,
+                              .price = 0,
+                              .qty = 0,
+                              .type = MsgType::Delete,
+                              .is_bid = false,
+                              .padding = {}});
+    manager.stop();
+
+    // output: 101 201 | 102 202 | -1 203 | 104 204 |
+    for (SymbolId symbol = 1; symbol <= 4; ++symbol) {
+      auto [bid, ask] = manager.book(symbol)->get_bbo();
+      std::cout << bid << " " << ask << " | ";
+    }
+    std::cout << "\n";
+  }
+
+  // asking for no shards still gets one
+  {
+    BookManager manager(0);
+    manager.submit(7, FeedMsg{.id = 1,
+                              .price = 100,
+                              .qty = 10,
+                              .type = MsgType::Add,
+                              .is_bid = true,
+                              .padding = {}});
+    manager.stop();
+    // output: 100
+    std::cout << manager.book(7)->get_bbo().first << "\n";
+  }
+
+  // only with STATS=1. counts everything book has done since it was created,
+  // including the reprice of order 1 (one erase + one create)
+  if constexpr (book_stats_enabled) {
+    auto stats = book.stats();
+    // output: 8 created, 5 erased, 5 deletes
+    std::cout << stats.levels_created << " created, " << stats.levels_erased
+              << " erased, "
+              << stats.cycles[static_cast<size_t>(StatOp::Delete)].total
+              << " deletes\n";
+  }
+
+  // tiny 64 tick window: 1000 recenters the empty window, 5000 is far outside
+  // it and lands in the fallback tree
+  OrderBook narrow(16, 1, 64);
+  narrow.add_order(1, true, 1000, 10);
+  narrow.add_order(2, true, 990, 10);
+  narrow.add_order(3, false, 5000, 10);
+  narrow.add_order(4, false, 1010, 10);
+  // output: 1000 1010
+  std::cout << narrow.get_bbo().first << " " << narrow.get_bbo().second << "\n";
+  narrow.delete_order(4);
+  // output: 1000 5000
+  std::cout << narrow.get_bbo().first << " " << narrow.get_bbo().second << "\n";
+
   return 0;
 }
 
@@ -208,7 +1015,8 @@ int main() {
 // - modify to zero qty should be treated as delete or handled explicitly
 //
 // can improve performance of std::list by instead using an intrusive linked
-// list + a custom allocator so that pointers are contiguous
+// list + a custom allocator so that pointers are contiguous (done, see
+// PooledLevels in basic_order_book.hpp)
 
 /* chatgpt answer
 
@@ -1,8 +1,26 @@
+#include "basic_order_book.hpp"
+#include "book_side.hpp"
+#include "depth_index.hpp"
+#include "journal.hpp"
+#include "mapped_file.hpp"
+#include "order_flow_bench.hpp"
+#include "order_index.hpp"
+#include "work_stealing_pool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
-#include <list>
-#include <map>
-#include <unordered_map>
+#include <limits>
+#include <optional>
+#include <random>
+#include <span>
+#include <sstream>
+#include <string>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 // second time writing an order book to keep it fresh in my memory
 
@@ -13,8 +31,40 @@
 // to support fast insertion, deletion and modification, let's use hashmaps as a
 // tertiary structure.
 //
-// so each book has a bids and asks std::map<int, Level>, a hashmap from id to
-// order and a hashmap from price to level (optional, for speed)
+// Book is a BasicOrderBook (basic_order_book.hpp) that matches:
+// - orders live in a struct of arrays store (SoaLevels), one array per field
+//   (id, price, qty, prev, next) addressed by 32 bit handles, and a level is a
+//   head and tail handle into it plus its aggregates. walking a level to match
+//   touches the qty and link arrays and the ids it trades with, never prices
+// - the sides are BookSides over a PriceLadder (book_side.hpp), levels in a
+//   flat array indexed by tick with the best price cached, and "best" and the
+//   matching comparison fixed per side at compile time
+// - id -> order is a FlatOrderIndex (order_index.hpp), open addressing with a
+//   direct indexed fast path for dense increasing ids
+//
+// add_order trades an incoming order against the opposite side in price-time
+// priority (best price first, oldest order first within a level) and only the
+// remainder rests, so the book is never locked or crossed. fills go into a
+// caller owned FillBuffer. a modify that changes price trades like a new
+// order. at the same price a smaller quantity keeps its place in the queue and
+// a larger one goes to the back of the level
+//
+// risk checks: each side keeps a DepthIndex (depth_index.hpp), a Fenwick tree
+// of resting quantity and notional by price, fed by the core's level hook.
+// quantity at or better than a price, the cost and vwap of sweeping some
+// quantity, and the price it would reach are O(log n) instead of a walk over
+// every level and order
+//
+// restarts: the book writes itself out as a binary snapshot (levels best
+// first, each followed by its orders in queue order) and loads one back by
+// mmapping it and walking it once. the snapshot records the feed sequence
+// number it was taken at, so only the messages after it need replaying
+//
+// durability between snapshots: with a Journal attached (journal.hpp), every
+// successful mutation is appended as a BookMsg. all the book pays for that is
+// a ring push, a background thread batches the writes and fdatasyncs. since
+// matching is deterministic, replaying the journal into a fresh book (or on
+// top of a snapshot) rebuilds the exact same state
 
 // second, interface design
 // third, tests <---- make sure to do this step first for practical questions!!
@@ -22,137 +72,958 @@
 
 using OrderId = uint64_t;
 using Price = uint64_t;
-struct Order {
+
+struct Fill {
+  OrderId maker_id;
+  OrderId taker_id;
+  Price price; // always the resting (maker) order's price
+  uint64_t qty;
+};
+
+// caller owned fill storage, allocated once and reused across add_order calls.
+// fills are appended, so the caller decides when to clear(). the book's state
+// never depends on the buffer: if it runs out of room we keep matching and only
+// flag that fills were dropped
+class FillBuffer {
+public:
+  explicit FillBuffer(size_t capacity) : fills(capacity) {}
+
+  void push(const Fill& fill) noexcept {
+    if (count == fills.size()) {
+      overflowed = true;
+      return;
+    }
+    fills[count++] = fill;
+  }
+
+  void clear() noexcept {
+    count = 0;
+    overflowed = false;
+  }
+
+  [[nodiscard]] std::span<const Fill> view() const noexcept {
+    return {fills.data(), count};
+  }
+  [[nodiscard]] bool dropped_fills() const noexcept { return overflowed; }
+
+private:
+  std::vector<Fill> fills;
+  size_t count = 0;
+  bool overflowed = false;
+};
+
+// BasicOrderBook's on_fill for Book, into the caller's buffer
+struct FillSink {
+  FillBuffer& fills;
+
+  void operator()(OrderId maker, OrderId taker, Price price,
+                  uint64_t qty) const noexcept {
+    fills.push(Fill{maker, taker, price, qty});
+  }
+};
+
+// binary feed (and journal) record, one per add_order / delete_order /
+// modify_order / reduce_order. seq is the feed's sequence number, increasing
+// through a file. Reduce carries the amount to reduce by in qty. records are
+// read straight out of files, so the side is a plain byte (1 bid, 0 ask)
+// rather than a bool, see well_formed()
+enum class MsgType : uint8_t { Add = 0, Delete = 1, Modify = 2, Reduce = 3 };
+
+struct BookMsg {
+  uint64_t seq;
   OrderId id;
   Price price;
   uint64_t qty;
+  MsgType type;
+  uint8_t is_bid;
+  uint8_t padding[6];
+};
+static_assert(sizeof(BookMsg) == 40);
+static_assert(std::is_trivially_copyable_v<BookMsg>);
+
+// a side byte of 0 or 1 and a type we know. Book::apply refuses anything else
+constexpr bool well_formed(const BookMsg& msg) noexcept {
+  return msg.is_bid <= 1 && msg.type <= MsgType::Reduce;
+}
+
+// snapshot layout: one header, then num_levels x (SnapshotLevel followed by
+// that level's SnapshotOrders). every record is a multiple of 8 bytes, so
+// they can all be read in place from the mapping
+struct SnapshotHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t sequence;
+  uint64_t num_levels;
+  uint64_t num_orders;
+};
+
+struct SnapshotLevel {
+  Price price;
+  uint64_t num_orders;
   bool is_bid;
+  uint8_t padding[7];
 };
 
-using Level = std::list<Order>;
+struct SnapshotOrder {
+  OrderId id;
+  uint64_t qty;
+};
+
+inline constexpr uint64_t snapshot_magic = 0x50414e534b4f4f42; // "BOOKSNAP"
+inline constexpr uint32_t snapshot_version = 1;
+
+// what Book plugs into BasicOrderBook's level hook: a DepthIndex per side, so
+// every change to a level's total lands in the depth index as it happens
+class DepthHooks {
+public:
+  DepthHooks(Price tick, size_t num_ticks)
+      : bids(tick, num_ticks), asks(tick, num_ticks) {}
+
+  template <Side S>
+  void level_changed(Price price, uint64_t before, uint64_t total_qty,
+                     uint32_t /*num_orders*/) {
+    if (total_qty > before) {
+      depth_for<S>().add(price, total_qty - before);
+    } else if (total_qty < before) {
+      depth_for<S>().remove(price, before - total_qty);
+    }
+  }
+
+  template <Side S>
+  DepthIndex<S>& depth_for() noexcept {
+    if constexpr (S == Side::Bid) {
+      return bids;
+    } else {
+      return asks;
+    }
+  }
 
-struct OrderPtr {
-  std::map<Price, Level>::iterator level_it;
-  Level::iterator order_it;
+  DepthIndex<Side::Bid> bids;
+  DepthIndex<Side::Ask> asks;
 };
 
 class Book {
 public:
-  Book() {}
+  // orders in parallel arrays behind 32 bit handles, a ladder per side,
+  // matching on add, and the depth index kept through the level hook
+  using Core = BasicOrderBook<SoaLevels, FlatIndex, LadderPrices<Price>,
+                              MatchOnAdd, DepthHooks>;
 
-  bool add_order(OrderId id, Price price, uint64_t qty, bool is_bid) {
-    if (orders.find(id) != orders.end())
+  // same arguments, in the same order, as the core
+  explicit Book(size_t capacity_hint = 1024, Price tick = 1,
+                size_t num_ticks = 4096)
+      : book(capacity_hint, tick, num_ticks) {}
+
+  // every trade is appended to fills. there's no default: matching always
+  // runs, so a caller that has nowhere to put fills would lose them silently.
+  // returns false for a duplicate id, or once Core::max_orders are resting
+  // (even if the order would have filled without resting). a fully filled
+  // order is still a successful add, it just never rests
+  bool add_order(OrderId id, Price price, uint64_t qty, bool is_bid,
+                 FillBuffer& fills) {
+    if (!book.add_order(id, is_bid, price, qty, FillSink{fills}))
       return false;
+    log(MsgType::Add, id, price, qty, is_bid);
+    return true;
+  }
 
-    auto& side = is_bid ? bids : asks;
-    auto [level_it, _] = side.try_emplace(price);
+  bool delete_order(OrderId id) {
+    if (!book.delete_order(id))
+      return false;
+    log(MsgType::Delete, id, 0, 0, false);
+    return true;
+  }
 
-    // MAJOR MISTAKE:
-    // this HAS to be a reference, since level_it->second IS the doubly linked
-    // list. in general, prefer to use the raw iterator and don't reassign to
-    // variables
-    auto& order_it = level_it->second;
-    order_it.emplace_back(id, price, qty, is_bid);
-    orders.emplace(std::piecewise_construct, std::forward_as_tuple(id),
-                   std::forward_as_tuple(level_it, prev(order_it.end())));
+  // a reprice may cross the spread, in which case it trades like a new order.
+  // at the same price a smaller quantity keeps its place in the queue, a
+  // larger one goes to the back of the level
+  bool modify_order(OrderId id, Price new_price, uint64_t new_qty,
+                    FillBuffer& fills) {
+    if (!book.modify_order(id, new_price, new_qty, FillSink{fills}))
+      return false;
+    log(MsgType::Modify, id, new_price, new_qty, false);
+    return true;
+  }
 
+  // partial cancel, keeps priority. reducing by the whole remaining quantity
+  // (or more) deletes the order
+  bool reduce_order(OrderId id, uint64_t reduce_by) {
+    if (!book.reduce_order(id, reduce_by))
+      return false;
+    log(MsgType::Reduce, id, 0, reduce_by, false);
     return true;
   }
 
-  bool delete_order(OrderId id) {
-    auto it = orders.find(id);
-    if (it == orders.end())
+  // false for a malformed record too, which leaves the book untouched
+  bool apply(const BookMsg& msg, FillBuffer& fills) {
+    if (!well_formed(msg))
       return false;
+    switch (msg.type) {
+      case MsgType::Add:
+        return add_order(msg.id, msg.price, msg.qty, msg.is_bid == 1, fills);
+      case MsgType::Delete:
+        return delete_order(msg.id);
+      case MsgType::Modify:
+        return modify_order(msg.id, msg.price, msg.qty, fills);
+      case MsgType::Reduce:
+        return reduce_order(msg.id, msg.qty);
+    }
+    return false;
+  }
+
+  // successful mutations are journaled from now on, numbered after
+  // journal_sequence(). nullptr stops it. the journal must outlive the book,
+  // or be detached first
+  void set_journal(Journal<BookMsg>* sink) noexcept { journal = sink; }
 
-    bool is_bid = it->second.order_it->is_bid;
-    it->second.level_it->second.erase(it->second.order_it);
-    if (it->second.level_it->second.empty()) {
-      is_bid ? bids.erase(it->second.level_it)
-             : asks.erase(it->second.level_it);
+  // seq of the last record journaled, or replayed by recover()
+  [[nodiscard]] uint64_t journal_sequence() const noexcept {
+    return journal_seq;
+  }
+
+  // replays the journal at path on top of whatever is in the book (nothing,
+  // or a snapshot taken at after_seq), skipping records up to after_seq. a
+  // partial record at the end, from a crash mid write, is ignored. returns the
+  // last seq replayed, or nullopt if the file can't be read. an empty file is
+  // a journal nothing was written to yet, zero records, the same as an empty
+  // feed everywhere else
+  //
+  // don't attach a journal before recovering, or the replay journals itself
+  std::optional<uint64_t> recover(const char* path, uint64_t after_seq = 0) {
+    MappedFile file(path);
+    if (!file.valid())
+      return std::nullopt;
+
+    auto records = file.bytes().first(file.size() / sizeof(BookMsg) *
+                                      sizeof(BookMsg));
+    auto msgs = std::span(reinterpret_cast<const BookMsg*>(records.data()),
+                          records.size() / sizeof(BookMsg));
+    // the trades were reported when the records were first applied, replaying
+    // them only rebuilds the book
+    FillBuffer fills(64);
+    journal_seq = after_seq;
+    for (const auto& msg : msgs) {
+      if (msg.seq <= after_seq)
+        continue;
+      fills.clear();
+      apply(msg, fills);
+      journal_seq = msg.seq;
     }
+    return journal_seq;
+  }
 
-    orders.erase(it);
-    return true;
+  [[nodiscard]] std::pair<Price, Price> get_bbo() const noexcept {
+    return {book.best_bid().value_or(0), book.best_ask().value_or(0)};
+  }
+
+  // resting orders
+  [[nodiscard]] size_t size() const noexcept { return book.size(); }
+  [[nodiscard]] bool contains(OrderId id) const noexcept {
+    return book.contains(id);
+  }
+
+  // resting quantity and notional by price, e.g. asks_depth().sweep(qty) is
+  // what a buy of qty would pay
+  [[nodiscard]] const DepthIndex<Side::Bid>& bid_depth() const noexcept {
+    return book.hooks().bids;
+  }
+  [[nodiscard]] const DepthIndex<Side::Ask>& ask_depth() const noexcept {
+    return book.hooks().asks;
   }
 
-  bool modify_order(OrderId id, Price new_price, uint64_t new_qty) {
-    auto it = orders.find(id);
-    if (it == orders.end() || new_qty == 0) {
+  // f(price, qty) for each level on one side, best first, qty summed over the
+  // level's orders. a walk over everything, for checking the depth index
+  template <typename F>
+  void for_each_level(bool is_bid, F&& f) const {
+    book.for_each_level(is_bid, [&](const Core::LevelSummary& level) {
+      uint64_t qty = 0;
+      book.for_each_order(is_bid, level.price,
+                          [&qty](OrderId, uint64_t order_qty) {
+                            qty += order_qty;
+                          });
+      f(level.price, qty);
+    });
+  }
+
+  // sequence is the feed sequence number of the last message applied. when
+  // the book is journaled, pass journal_sequence(): loading the snapshot
+  // carries on journaling after it, and recover(path, sequence) replays the
+  // tail
+  bool save_snapshot(const char* path, uint64_t sequence) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
       return false;
-    }
 
-    auto old_price = it->second.order_it->price;
-    it->second.order_it->qty = new_qty;
+    auto write = [&out](const auto& record) {
+      out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    };
 
-    if (new_price != old_price) {
-      auto is_bid = it->second.order_it->is_bid;
-      delete_order(id);
-      add_order(id, new_price, new_qty, is_bid);
-      return true;
+    write(SnapshotHeader{.magic = snapshot_magic,
+                         .version = snapshot_version,
+                         .reserved = 0,
+                         .sequence = sequence,
+                         .num_levels = book.num_levels(),
+                         .num_orders = book.size()});
+
+    for (bool is_bid : {true, false}) {
+      book.for_each_level(is_bid, [&](const Core::LevelSummary& level) {
+        write(SnapshotLevel{.price = level.price,
+                            .num_orders = level.num_orders,
+                            .is_bid = is_bid,
+                            .padding = {}});
+        book.for_each_order(is_bid, level.price,
+                            [&](OrderId id, uint64_t qty) {
+                              write(SnapshotOrder{.id = id, .qty = qty});
+                            });
+      });
     }
 
-    return true;
+    return static_cast<bool>(out.flush());
   }
 
-  [[nodiscard]] std::pair<Price, Price> get_bbo() const noexcept {
-    Price best_bid = bids.empty() ? 0 : bids.rbegin()->first;
-    Price best_ask = asks.empty() ? 0 : asks.begin()->first;
-    return {best_bid, best_ask};
+  // loads a snapshot into an empty book and returns the sequence number it was
+  // taken at. the whole file is validated before anything is touched, so a
+  // rejected snapshot (nullopt) leaves the book as it was. then it's loaded in
+  // a single pass: levels arrive unique and orders in queue order, so there's
+  // no matching and no searching, and the order store and id index are both
+  // sized once up front. journal_sequence() picks up from the snapshot's
+  // sequence, so records journaled next follow it
+  std::optional<uint64_t> load_snapshot(const char* path) {
+    MappedFile file(path);
+    if (!file.valid() || book.size() != 0 ||
+        file.size() < sizeof(SnapshotHeader))
+      return std::nullopt;
+
+    auto bytes = file.bytes();
+    const auto& header = *reinterpret_cast<const SnapshotHeader*>(bytes.data());
+    if (header.magic != snapshot_magic || header.version != snapshot_version)
+      return std::nullopt;
+
+    // the layout: level / order counts that add up to the file size, and
+    // orders that add up to the header's count. the header's counts are only
+    // trusted once the walk has matched them, nothing is multiplied by them
+    // before that (a corrupt count could wrap) or sized from them
+    size_t offset = sizeof(SnapshotHeader);
+    uint64_t num_orders = 0;
+    for (uint64_t i = 0; i < header.num_levels; ++i) {
+      if (file.size() - offset < sizeof(SnapshotLevel))
+        return std::nullopt;
+      const auto& level =
+          *reinterpret_cast<const SnapshotLevel*>(bytes.data() + offset);
+      offset += sizeof(SnapshotLevel);
+      if (level.num_orders > (file.size() - offset) / sizeof(SnapshotOrder))
+        return std::nullopt;
+      offset += level.num_orders * sizeof(SnapshotOrder);
+      num_orders += level.num_orders;
+    }
+    if (offset != file.size() || num_orders != header.num_orders ||
+        num_orders > Core::max_orders)
+      return std::nullopt;
+
+    // the contents: a side byte that's really a bool, no empty levels or
+    // orders, each side's levels strictly best first (so no duplicates), a
+    // book that isn't crossed, and no id twice
+    std::optional<Price> best_bid;
+    std::optional<Price> best_ask;
+    std::optional<Price> last_bid;
+    std::optional<Price> last_ask;
+    std::vector<OrderId> ids;
+    ids.reserve(header.num_orders);
+    offset = sizeof(SnapshotHeader);
+    for (uint64_t i = 0; i < header.num_levels; ++i) {
+      const auto& snap =
+          *reinterpret_cast<const SnapshotLevel*>(bytes.data() + offset);
+      const auto* snap_orders = reinterpret_cast<const SnapshotOrder*>(
+          bytes.data() + offset + sizeof(SnapshotLevel));
+      offset += sizeof(SnapshotLevel) + snap.num_orders * sizeof(SnapshotOrder);
+
+      uint8_t side_byte;
+      std::memcpy(&side_byte, &snap.is_bid, 1);
+      if (side_byte > 1 || snap.num_orders == 0)
+        return std::nullopt;
+      bool in_order = side_byte == 1 ? (!last_bid || snap.price < *last_bid)
+                                     : (!last_ask || snap.price > *last_ask);
+      if (!in_order)
+        return std::nullopt;
+      (side_byte == 1 ? last_bid : last_ask) = snap.price;
+      auto& best = side_byte == 1 ? best_bid : best_ask;
+      if (!best)
+        best = snap.price;
+
+      for (uint64_t j = 0; j < snap.num_orders; ++j) {
+        if (snap_orders[j].qty == 0)
+          return std::nullopt;
+        ids.push_back(snap_orders[j].id);
+      }
+    }
+    if (best_bid && best_ask && *best_bid >= *best_ask)
+      return std::nullopt;
+    std::sort(ids.begin(), ids.end());
+    if (std::adjacent_find(ids.begin(), ids.end()) != ids.end())
+      return std::nullopt;
+
+    book.reserve(header.num_orders);
+    offset = sizeof(SnapshotHeader);
+    for (uint64_t i = 0; i < header.num_levels; ++i) {
+      const auto& snap =
+          *reinterpret_cast<const SnapshotLevel*>(bytes.data() + offset);
+      const auto* snap_orders = reinterpret_cast<const SnapshotOrder*>(
+          bytes.data() + offset + sizeof(SnapshotLevel));
+      offset += sizeof(SnapshotLevel) + snap.num_orders * sizeof(SnapshotOrder);
+
+      for (uint64_t j = 0; j < snap.num_orders; ++j)
+        book.restore_order(snap_orders[j].id, snap.is_bid, snap.price,
+                           snap_orders[j].qty);
+    }
+    journal_seq = header.sequence;
+    return header.sequence;
   }
 
   friend std::ostream& operator<<(std::ostream& os, const Book& book) {
-    os << "====================\n";
-    for (auto level_it = book.asks.rbegin(); level_it != book.asks.rend();
-         ++level_it) {
-      os << "ask: $" << level_it->first << " | ";
-      for (auto order_it = level_it->second.begin();
-           order_it != level_it->second.end();) {
-        os << "{ id: " << order_it->id << " , qty: " << order_it->qty << " }";
-        if (++order_it != level_it->second.end())
-          os << " -> ";
-      }
-      os << "\n";
+    return os << book.book;
+  }
+
+private:
+  // journals the operation as called, not its effects: replaying it against
+  // the same book state redoes the same matching
+  void log(MsgType type, OrderId id, Price price, uint64_t qty, bool is_bid) {
+    if (!journal)
+      return;
+    journal->append(BookMsg{.seq = ++journal_seq,
+                            .id = id,
+                            .price = price,
+                            .qty = qty,
+                            .type = type,
+                            .is_bid = is_bid,
+                            .padding = {}});
+  }
+
+  Core book;
+
+  Journal<BookMsg>* journal = nullptr;
+  uint64_t journal_seq = 0;
+};
+
+// order flow benchmark: `./build/order_book_2 bench ops=... cancel=...`, see
+// order_flow_bench.hpp
+struct BookBench {
+  Book book;
+  // fills are collected like a real caller would, then dropped
+  FillBuffer fills{64};
+
+  void add(uint64_t id, bool is_bid, uint64_t price, uint64_t qty) {
+    fills.clear();
+    book.add_order(id, price, qty, is_bid, fills);
+  }
+  void remove(uint64_t id) { book.delete_order(id); }
+  void modify(uint64_t id, uint64_t price, uint64_t qty) {
+    fills.clear();
+    book.modify_order(id, price, qty, fills);
+  }
+};
+
+// writes a snapshot by hand, levels in the order given, each followed by its
+// orders. side_byte goes into is_bid as is, and header_orders (if given) into
+// the header's num_orders, to be able to write bad ones
+struct HandLevel {
+  Price price;
+  uint8_t side_byte;
+  std::vector<SnapshotOrder> orders;
+};
+
+void write_hand_snapshot(const char* path, std::span<const HandLevel> levels,
+                         std::optional<uint64_t> header_orders = {}) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  auto write = [&out](const auto& record) {
+    out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+  };
+  uint64_t num_orders = 0;
+  for (const auto& level : levels)
+    num_orders += level.orders.size();
+  num_orders = header_orders.value_or(num_orders);
+  write(SnapshotHeader{.magic = snapshot_magic,
+                       .version = snapshot_version,
+                       .reserved = 0,
+                       .sequence = 7,
+                       .num_levels = levels.size(),
+                       .num_orders = num_orders});
+  for (const auto& level : levels) {
+    SnapshotLevel snap{.price = level.price,
+                       .num_orders = level.orders.size(),
+                       .is_bid = false,
+                       .padding = {}};
+    std::memcpy(&snap.is_bid, &level.side_byte, 1);
+    write(snap);
+    for (const auto& order : level.orders)
+      write(order);
+  }
+}
+
+// one side's depth index against the same questions answered by walking its
+// levels: total, quantity through random limits, and random sweeps
+template <Side S>
+bool depth_matches_levels(const Book& book, const DepthIndex<S>& depth,
+                          std::mt19937_64& rng) {
+  std::vector<std::pair<Price, uint64_t>> levels; // best first
+  uint64_t total = 0;
+  book.for_each_level(S == Side::Bid, [&](Price price, uint64_t qty) {
+    levels.emplace_back(price, qty);
+    total += qty;
+  });
+  if (depth.total_qty() != total)
+    return false;
+
+  for (int i = 0; i < 20; ++i) {
+    Price limit = 800 + rng() % 400;
+    uint64_t through = 0;
+    for (const auto& [price, qty] : levels) {
+      if (!DepthIndex<S>::better(limit, price))
+        through += qty;
     }
+    if (depth.qty_through(limit) != through)
+      return false;
+
+    auto want = rng() % (total + 50);
+    typename DepthIndex<S>::Sweep walked;
+    for (const auto& [price, qty] : levels) {
+      if (walked.qty == want)
+        break;
+      auto take = std::min(qty, want - walked.qty);
+      walked.qty += take;
+      walked.notional += take * price;
+      walked.last_price = price;
+    }
+    auto swept = depth.sweep(want);
+    if (swept.qty != walked.qty || swept.notional != walked.notional ||
+        (want != 0 && swept.last_price != walked.last_price))
+      return false;
+  }
+  return true;
+}
 
-    os << "\n";
+// random adds, deletes, modifies and reduces around 1000, checking both depth
+// indexes every so often. the window is 64 ticks so plenty of levels land in
+// the fallback, and tick 3 puts some prices off the grid as well
+bool random_depth_check(Price tick, int num_ops) {
+  std::mt19937_64 rng(tick);
+  Book book(16, tick, 64);
+  FillBuffer fills(64);
+  std::vector<OrderId> live;
+  OrderId next_id = 1;
+  auto near = [&rng] { return static_cast<Price>(900 + rng() % 200); };
 
-    for (auto level_it = book.bids.rbegin(); level_it != book.bids.rend();
-         ++level_it) {
-      os << "bid: $" << level_it->first << " | ";
-      for (auto order_it = level_it->second.begin();
-           order_it != level_it->second.end();) {
-        os << "{ id: " << order_it->id << " , qty: " << order_it->qty << " }";
-        if (++order_it != level_it->second.end())
-          os << " -> ";
+  for (int i = 0; i < num_ops; ++i) {
+    fills.clear();
+    auto op = rng() % 10;
+    if (op < 5 || live.empty()) {
+      bool is_bid = rng() % 2 == 0;
+      auto price = is_bid ? near() - 30 : near() + 30;
+      if (rng() % 20 == 0)
+        price = is_bid ? price - 200 : price + 200;
+      book.add_order(next_id, price, 1 + rng() % 20, is_bid, fills);
+      live.push_back(next_id++);
+    } else {
+      auto pick = rng() % live.size();
+      auto id = live[pick];
+      if (op < 7)
+        book.delete_order(id);
+      else if (op < 8)
+        book.modify_order(id, near(), 1 + rng() % 30, fills);
+      else
+        book.reduce_order(id, 1 + rng() % 10);
+      // gone if it was deleted, fully reduced, or repriced and filled
+      if (!book.contains(id)) {
+        live[pick] = live.back();
+        live.pop_back();
       }
-      os << "\n";
     }
-    os << "====================";
-    return os;
+    if (i % 97 == 0 && (!depth_matches_levels(book, book.bid_depth(), rng) ||
+                        !depth_matches_levels(book, book.ask_depth(), rng)))
+      return false;
   }
+  return true;
+}
 
-private:
-  std::map<Price, Level> bids; // best bid = end of map
-  std::map<Price, Level> asks; // best ask = start of map
-  std::unordered_map<OrderId, OrderPtr> orders;
+// the same random flow through a Book and a BasicOrderBook with other
+// policies (basic_order_book.hpp) must leave the same orders in the same
+// queues and trade the same quantity. ids are drawn from a small range so adds
+// collide with live ones, and operations on ids that are gone, modifies to
+// zero and reprices that trade all come up
+template <typename Basic>
+bool matches_basic_book(int num_ops) {
+  std::mt19937_64 rng(5);
+  Book book(64, 1, 64);
+  Basic basic(64, 1, 64);
+  FillBuffer fills(4096);
+  uint64_t book_filled = 0;
+  uint64_t basic_filled = 0;
+  auto on_fill = [&](OrderId, OrderId, Price, uint64_t qty) {
+    basic_filled += qty;
+  };
+
+  for (int i = 1; i <= num_ops; ++i) {
+    auto op = rng() % 4;
+    OrderId id = rng() % 400;
+    Price price = 900 + rng() % 300;
+    uint64_t qty = rng() % 9;
+    bool is_bid = rng() % 2 == 0;
+    fills.clear();
+    if (op == 0) {
+      book.add_order(id, price, qty + 1, is_bid, fills);
+      basic.add_order(id, is_bid, price, qty + 1, on_fill);
+    } else if (op == 1) {
+      book.delete_order(id);
+      basic.delete_order(id);
+    } else if (op == 2) {
+      book.modify_order(id, price, qty, fills);
+      basic.modify_order(id, price, qty, on_fill);
+    } else {
+      book.reduce_order(id, qty);
+      basic.reduce_order(id, qty);
+    }
+    for (const auto& fill : fills.view())
+      book_filled += fill.qty;
+
+    if (i % 1000 == 0) {
+      std::ostringstream expected;
+      std::ostringstream actual;
+      expected << book;
+      actual << basic;
+      if (expected.str() != actual.str() || book_filled != basic_filled)
+        return false;
+    }
+  }
+  return true;
+}
+
+// capacity hint for a book that replays a feed of num_msgs. what it has to
+// hold is the peak number of resting orders, which a message count only
+// bounds from above. overshooting is cheap: the store just reserves address
+// space, and the id index caps its window (see FlatOrderIndex)
+size_t capacity_for_feed(size_t num_msgs) noexcept {
+  return num_msgs / 2 + 1;
+}
+
+// the feed tools skip records that aren't well_formed(), and say so
+void report_malformed(const char* feed_path, size_t malformed) {
+  if (malformed != 0)
+    std::cerr << feed_path << ": skipped " << malformed
+              << " malformed messages\n";
+}
+
+// `./build/order_book_2 snapshot feed.bin out.snap` replays a whole feed and
+// snapshots the result
+int take_snapshot(const char* feed_path, const char* snapshot_path) {
+  MappedFile feed(feed_path);
+  if (!feed.valid() || feed.size() % sizeof(BookMsg) != 0) {
+    std::cerr << "could not map " << feed_path << " as a feed file\n";
+    return 1;
+  }
+
+  auto msgs = feed.as<BookMsg>();
+  Book book(capacity_for_feed(msgs.size()));
+  FillBuffer fills(64); // only the book's final state is wanted
+  size_t malformed = 0;
+  for (const auto& msg : msgs) {
+    fills.clear();
+    if (!well_formed(msg)) {
+      ++malformed;
+      continue;
+    }
+    book.apply(msg, fills);
+  }
+  report_malformed(feed_path, malformed);
+
+  auto sequence = msgs.empty() ? 0 : msgs.back().seq;
+  if (!book.save_snapshot(snapshot_path, sequence)) {
+    std::cerr << "could not write " << snapshot_path << "\n";
+    return 1;
+  }
+  std::cout << "snapshot at seq " << sequence << "\n";
+  return 0;
+}
+
+// `./build/order_book_2 restore book.snap feed.bin` loads the snapshot, then
+// replays only the feed messages after its sequence number
+int restore(const char* snapshot_path, const char* feed_path) {
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+
+  Book book;
+  auto sequence = book.load_snapshot(snapshot_path);
+  if (!sequence) {
+    std::cerr << "could not load snapshot " << snapshot_path << "\n";
+    return 1;
+  }
+  auto loaded = clock::now();
+
+  MappedFile feed(feed_path);
+  if (!feed.valid() || feed.size() % sizeof(BookMsg) != 0) {
+    std::cerr << "could not map " << feed_path << " as a feed file\n";
+    return 1;
+  }
+  auto msgs = feed.as<BookMsg>();
+  auto tail = std::partition_point(
+      msgs.begin(), msgs.end(),
+      [&](const BookMsg& msg) { return msg.seq <= *sequence; });
+  FillBuffer fills(64); // as in take_snapshot, only the state is wanted
+  size_t malformed = 0;
+  for (auto it = tail; it != msgs.end(); ++it) {
+    fills.clear();
+    if (!well_formed(*it)) {
+      ++malformed;
+      continue;
+    }
+    book.apply(*it, fills);
+  }
+  auto done = clock::now();
+  report_malformed(feed_path, malformed);
+
+  using ms = std::chrono::duration<double, std::milli>;
+  std::cout << "snapshot seq " << *sequence << " loaded in "
+            << ms(loaded - start).count() << " ms, replayed "
+            << std::distance(tail, msgs.end()) << " msgs in "
+            << ms(done - loaded).count() << " ms\n"
+            << "bbo: " << book.get_bbo().first << " " << book.get_bbo().second
+            << "\n";
+  return 0;
+}
+
+// `./build/order_book_2 journal feed.bin out.journal [commit_us]` applies a
+// feed with journaling on and reports what it cost the mutation path
+int write_journal(const char* feed_path, const char* journal_path,
+                  std::chrono::microseconds interval) {
+  MappedFile feed(feed_path);
+  if (!feed.valid() || feed.size() % sizeof(BookMsg) != 0) {
+    std::cerr << "could not map " << feed_path << " as a feed file\n";
+    return 1;
+  }
+  ::unlink(journal_path);
+  Journal<BookMsg> journal(journal_path, 65536, interval);
+  if (!journal.is_open()) {
+    std::cerr << "could not open " << journal_path << "\n";
+    return 1;
+  }
+
+  auto msgs = feed.as<BookMsg>();
+  Book book(capacity_for_feed(msgs.size()));
+  book.set_journal(&journal);
+
+  // what's measured is the journal's cost, the fills are dropped
+  FillBuffer fills(64);
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  for (const auto& msg : msgs) {
+    fills.clear();
+    book.apply(msg, fills);
+  }
+  auto applied = clock::now();
+  journal.close();
+  auto closed = clock::now();
+
+  using ms = std::chrono::duration<double, std::milli>;
+  std::cout << "applied " << msgs.size() << " msgs in "
+            << ms(applied - start).count() << " ms, journaled "
+            << journal.appended_count() << " (ring full "
+            << journal.full_wait_count() << " times), final commit "
+            << ms(closed - applied).count() << " ms, durable "
+            << journal.durable_count() << (journal.healthy() ? "" : " FAILED")
+            << "\n";
+  return journal.healthy() ? 0 : 1;
+}
+
+// `./build/order_book_2 recover book.journal` rebuilds a book from a journal
+int recover(const char* journal_path) {
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  Book book;
+  auto sequence = book.recover(journal_path);
+  if (!sequence) {
+    std::cerr << "could not read journal " << journal_path << "\n";
+    return 1;
+  }
+  auto ms = std::chrono::duration<double, std::milli>(clock::now() - start);
+  std::cout << "recovered through seq " << *sequence << " in " << ms.count()
+            << " ms\n"
+            << "bbo: " << book.get_bbo().first << " " << book.get_bbo().second
+            << "\n";
+  return 0;
+}
+
+// what one symbol-day did. per task, so nothing is shared until the merge
+struct DayStats {
+  uint64_t msgs = 0;
+  uint64_t rejected = 0;  // duplicate adds, unknown ids
+  uint64_t malformed = 0; // bad side byte or type, skipped
+  uint64_t fills = 0;
+  uint64_t filled_qty = 0;
+  uint64_t fill_overflows = 0; // msgs with more fills than the FillBuffer held
+  uint64_t resting_orders = 0;
+  double seconds = 0;
+
+  DayStats& operator+=(const DayStats& other) noexcept {
+    msgs += other.msgs;
+    rejected += other.rejected;
+    malformed += other.malformed;
+    fills += other.fills;
+    filled_qty += other.filled_qty;
+    fill_overflows += other.fill_overflows;
+    resting_orders += other.resting_orders;
+    seconds += other.seconds;
+    return *this;
+  }
 };
 
-int main() {
+// `./build/order_book_2 backtest dir [threads]` replays every feed file in dir
+// (one symbol-day each) through its own Book, on a WorkStealingPool sized to
+// the machine. the book's order store and index, sized from the file, are the
+// task's arena and go away with it. fills go into a per worker FillBuffer. a
+// message that fills more orders than that holds loses the rest of its fills
+// from the counts, which is reported per file rather than hidden
+int backtest(const char* dir, size_t num_threads) {
+  struct FeedFile {
+    std::filesystem::path path;
+    uintmax_t size;
+  };
+  std::vector<FeedFile> files;
+  std::error_code error;
+  for (const auto& entry : std::filesystem::directory_iterator(dir, error)) {
+    std::error_code stat_error;
+    if (!entry.is_regular_file(stat_error))
+      continue;
+    auto size = entry.file_size(stat_error);
+    if (stat_error || size % sizeof(BookMsg) != 0) {
+      std::cerr << "skipping " << entry.path().string() << ": "
+                << (stat_error ? stat_error.message()
+                               : "not a whole number of messages")
+                << "\n";
+      continue;
+    }
+    files.push_back({entry.path(), size});
+  }
+  if (error || files.empty()) {
+    std::cerr << "no feed files in " << dir << "\n";
+    return 1;
+  }
+
+  // biggest first, so the long days aren't what the run ends waiting on
+  std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) {
+    return a.size > b.size;
+  });
+
+  WorkStealingPool pool(num_threads);
+  std::vector<DayStats> days(files.size());
+  std::vector<FillBuffer> fill_buffers(pool.size(), FillBuffer(4096));
+
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  pool.run(files.size(), [&](size_t task, size_t worker) {
+    auto day_start = clock::now();
+    MappedFile feed(files[task].path.c_str());
+    auto msgs = feed.as<BookMsg>();
+    auto& fills = fill_buffers[worker];
+    auto& day = days[task];
+
+    Book book(capacity_for_feed(msgs.size()));
+    for (const auto& msg : msgs) {
+      fills.clear();
+      if (!well_formed(msg)) {
+        ++day.malformed;
+        continue;
+      }
+      if (!book.apply(msg, fills))
+        ++day.rejected;
+      for (const auto& fill : fills.view())
+        day.filled_qty += fill.qty;
+      day.fills += fills.view().size();
+      day.fill_overflows += fills.dropped_fills();
+    }
+    day.msgs = msgs.size();
+    day.resting_orders = book.size();
+    day.seconds = std::chrono::duration<double>(clock::now() - day_start)
+                      .count();
+  });
+  auto wall = std::chrono::duration<double>(clock::now() - start).count();
+
+  DayStats total;
+  for (size_t i = 0; i < days.size(); ++i) {
+    if (days[i].fill_overflows != 0) {
+      std::cerr << files[i].path.string() << ": " << days[i].fill_overflows
+                << " msgs filled more orders than the fill buffer holds, "
+                   "its fill counts are short\n";
+    }
+    total += days[i];
+  }
+  std::cout << files.size() << " symbol-days on " << pool.size()
+            << " threads (" << pool.steal_count() << " stolen)\n"
+            << "messages:   " << total.msgs << " (" << total.rejected
+            << " rejected, " << total.malformed << " malformed)\n"
+            << "fills:      " << total.fills << " for " << total.filled_qty
+            << (total.fill_overflows != 0 ? " (short, see above)" : "")
+            << "\n"
+            << "resting:    " << total.resting_orders << " at end of day\n"
+            << "wall:       " << wall << " s, "
+            << static_cast<double>(total.msgs) / wall << " msgs/s\n"
+            << "busy:       " << total.seconds << " s, "
+            << total.seconds / wall << "x parallel\n";
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 2 && std::string_view(argv[1]) == "bench") {
+    auto config = parse_bench_args(std::span(argv + 2, argv + argc));
+    if (!config) {
+      std::cerr << "usage: order_book_2 bench " << bench_options << "\n";
+      return 1;
+    }
+    BookBench bench{Book(config->depth * 2)};
+    return run_bench("Book", bench, *config);
+  }
+  if (argc == 4 && std::string_view(argv[1]) == "snapshot") {
+    return take_snapshot(argv[2], argv[3]);
+  }
+  if (argc == 4 && std::string_view(argv[1]) == "restore") {
+    return restore(argv[2], argv[3]);
+  }
+  if ((argc == 4 || argc == 5) && std::string_view(argv[1]) == "journal") {
+    auto commit_us = argc == 5 ? parse_count(argv[4]) : 1000;
+    if (!commit_us) {
+      std::cerr << "usage: order_book_2 journal feed.bin out.journal "
+                   "[commit_us]\n";
+      return 1;
+    }
+    return write_journal(argv[2], argv[3],
+                         std::chrono::microseconds(*commit_us));
+  }
+  if (argc == 3 && std::string_view(argv[1]) == "recover") {
+    return recover(argv[2]);
+  }
+  if ((argc == 3 || argc == 4) && std::string_view(argv[1]) == "backtest") {
+    auto threads = argc == 4 ? parse_count(argv[3])
+                             : WorkStealingPool::default_threads();
+    if (!threads) {
+      std::cerr << "usage: order_book_2 backtest dir [threads]\n";
+      return 1;
+    }
+    return backtest(argv[2], *threads);
+  }
 
   Book book{};
+  FillBuffer fills(16);
 
   // output: "0 0"
   std::cout << book.get_bbo().first << " " << book.get_bbo().second << "\n";
 
   std::cout << std::boolalpha;
   // output: true
-  std::cout << book.add_order(0, 10, 10, true) << "\n";
+  std::cout << book.add_order(0, 10, 10, true, fills) << "\n";
   // output: false
-  std::cout << book.add_order(0, 10, 10, true) << "\n";
+  std::cout << book.add_order(0, 10, 10, true, fills) << "\n";
   // output: true
-  std::cout << book.add_order(1, 15, 10, false) << "\n";
+  std::cout << book.add_order(1, 15, 10, false, fills) << "\n";
   // output: true
-  std::cout << book.add_order(2, 16, 10, false) << "\n";
+  std::cout << book.add_order(2, 16, 10, false, fills) << "\n";
 
   std::cout << std::noboolalpha;
 
@@ -163,14 +1034,14 @@ int main() {
   // output: "10 16"
   std::cout << book.get_bbo().first << " " << book.get_bbo().second << "\n";
 
-  book.modify_order(2, 17, 20);
+  book.modify_order(2, 17, 20, fills);
   // output: "10 17"
   std::cout << book.get_bbo().first << " " << book.get_bbo().second << "\n";
 
   book = Book{};
-  book.add_order(1, 10, 100, true);
-  book.modify_order(1, 12, 200);
-  book.add_order(2, 20, 100, false);
+  book.add_order(1, 10, 100, true, fills);
+  book.modify_order(1, 12, 200, fills);
+  book.add_order(2, 20, 100, false, fills);
 
   std::cout << book << "\n";
 
@@ -185,17 +1056,204 @@ int main() {
   // output: -1 -1
   std::cout << book.get_bbo().first << " " << book.get_bbo().second << "\n";
 
-  book.add_order(3, 10, 10, true);
-  book.add_order(4, 9, 8, true);
-  book.add_order(5, 5, 1, true);
-  book.add_order(6, 5, 10, true);
+  book.add_order(3, 10, 10, true, fills);
+  book.add_order(4, 9, 8, true, fills);
+  book.add_order(5, 5, 1, true, fills);
+  book.add_order(6, 5, 10, true, fills);
 
-  book.add_order(7, 15, 5, false);
-  book.add_order(8, 20, 10, false);
+  book.add_order(7, 15, 5, false, fills);
+  book.add_order(8, 20, 10, false, fills);
 
   std::cout << book << "\n";
   // output: 10 15
   std::cout << book.get_bbo().first << " " << book.get_bbo().second << "\n";
 
+  // aggressive sell for 20 @ 9: takes all of id 3 @ 10, then 8 of id 4 @ 9,
+  // then rests the last 2 @ 9 on the ask side
+  fills.clear();
+  std::cout << std::boolalpha;
+  // output: true
+  std::cout << book.add_order(9, 9, 20, false, fills) << "\n";
+  std::cout << std::noboolalpha;
+  for (const auto& fill : fills.view()) {
+    // output: maker 3 taker 9 10 x 10
+    //         maker 4 taker 9 9 x 8
+    std::cout << "maker " << fill.maker_id << " taker " << fill.taker_id << " "
+              << fill.price << " x " << fill.qty << "\n";
+  }
+  // output: 5 9
+  std::cout << book.get_bbo().first << " " << book.get_bbo().second << "\n";
+
+  // 5 grows and goes behind 6, 6 is partially cancelled and stays in front
+  book.modify_order(5, 5, 3, fills);
+  book.reduce_order(6, 4);
+  // output: bid: $5 | { id: 6 , qty: 6 } -> { id: 5 , qty: 3 }
+  std::cout << book << "\n";
+
+  fills.clear();
+  // buy 1 @ 9 fully fills against the resting remainder of id 9 and never
+  // rests itself
+  book.add_order(10, 9, 1, true, fills);
+  // output: 1 5 9
+  std::cout << fills.view().size() << " " << book.get_bbo().first << " "
+            << book.get_bbo().second << "\n";
+
+  // pre-trade questions, answered from the depth index. the asks are now
+  // 1 @ 9, 5 @ 15 and 10 @ 20
+  // output: 6 9
+  std::cout << book.ask_depth().qty_through(15) << " "
+            << book.bid_depth().qty_through(5) << "\n";
+  // buying 10 takes 1 @ 9, 5 @ 15 and 4 @ 20
+  auto sweep = book.ask_depth().sweep(10);
+  // output: 10 164 16.4 20
+  std::cout << sweep.qty << " " << sweep.notional << " " << sweep.vwap() << " "
+            << sweep.last_price.value_or(0) << "\n";
+  // output: 20 0 (there are only 16 to buy)
+  std::cout << book.ask_depth().price_for(16).value_or(0) << " "
+            << book.ask_depth().price_for(17).value_or(0) << "\n";
+  // and against walking the levels, over random flow
+  // output: true
+  std::cout << std::boolalpha
+            << (random_depth_check(1, 200000) && random_depth_check(3, 200000))
+            << std::noboolalpha << "\n";
+
+  // Book's SoaLevels against the same template with pooled nodes and with
+  // std::list queues
+  // output: true
+  std::cout << std::boolalpha
+            << (matches_basic_book<BasicOrderBook<PooledLevels, FlatIndex,
+                                                  LadderPrices<Price>>>(
+                    300000) &&
+                matches_basic_book<BasicOrderBook<ListLevels, HashIndex,
+                                                  TreePrices<Price>>>(300000))
+            << std::noboolalpha << "\n";
+
+  // round trip through a snapshot
+  const char* snapshot_path = "/tmp/order_book_2_demo.snap";
+  book.save_snapshot(snapshot_path, 42);
+  Book restored;
+  auto sequence = restored.load_snapshot(snapshot_path);
+  // output: 42
+  std::cout << sequence.value_or(0) << "\n";
+  // output: the same book as before the snapshot: asks at 20, 15 and 9 (what
+  // is left of id 9) and both bids at 5
+  std::cout << restored << "\n";
+  // output: false (the book isn't empty any more)
+  std::cout << std::boolalpha
+            << restored.load_snapshot(snapshot_path).has_value()
+            << std::noboolalpha << "\n";
+
+  // snapshots whose sizes add up but that don't describe a valid book are
+  // refused whole, and leave the book empty
+  {
+    const char* hand_path = "/tmp/order_book_2_hand.snap";
+    auto loads = [hand_path](std::vector<HandLevel> levels,
+                             std::optional<uint64_t> header_orders = {}) {
+      write_hand_snapshot(hand_path, levels, header_orders);
+      Book hand;
+      bool loaded = hand.load_snapshot(hand_path).has_value();
+      return loaded ? "loaded" : hand.size() == 0 ? "refused" : "PARTIAL";
+    };
+    HandLevel bid{10, 1, {{1, 5}}};
+    HandLevel ask{11, 0, {{2, 5}}};
+    // output: loaded
+    std::cout << loads({bid, ask}) << "\n";
+    // output: refused refused refused refused
+    std::cout << loads({bid, {11, 0, {}}}) << " "             // empty level
+              << loads({bid, {11, 0, {{1, 5}}}}) << " "       // id 1 twice
+              << loads({bid, {10, 0, {{2, 5}}}}) << " "       // crossed
+              << loads({bid, {11, 2, {{2, 5}}}}) << "\n";     // side byte 2
+    // corrupt order counts in the header: one too many, and a header alone
+    // claiming 2^60 orders, which must be refused rather than sized for
+    // output: refused refused
+    std::cout << loads({bid, ask}, 3) << " "
+              << loads({}, uint64_t{1} << 60) << "\n";
+  }
+
+  // journal a session, then rebuild it from the journal alone
+  const char* journal_path = "/tmp/order_book_2_demo.journal";
+  ::unlink(journal_path);
+  {
+    Journal<BookMsg> journal(journal_path);
+    Book live;
+    live.set_journal(&journal);
+    live.add_order(1, 100, 10, true, fills);
+    live.add_order(2, 101, 5, false, fills);
+    live.add_order(3, 100, 4, true, fills);
+    // takes 1 and 2 of 3, then nothing
+    live.add_order(4, 100, 12, false, fills);
+    live.reduce_order(3, 1);
+    live.modify_order(2, 102, 6, fills);
+    live.delete_order(99); // fails, so it isn't journaled
+    journal.close();
+    // output: 6 records, 6 durable
+    std::cout << journal.appended_count() << " records, "
+              << journal.durable_count() << " durable\n";
+  }
+  Book recovered;
+  auto last = recovered.recover(journal_path);
+  // output: 6
+  std::cout << last.value_or(0) << "\n";
+  // output: the bid at 100 is what's left of 3, the ask at 102 is 2
+  std::cout << recovered << "\n";
+
+  // snapshot it, restart from the snapshot and keep journaling: the next
+  // record follows the snapshot's seq, so the snapshot plus the tail after it
+  // rebuilds the book
+  const char* restart_path = "/tmp/order_book_2_restart.snapshot";
+  recovered.save_snapshot(restart_path, recovered.journal_sequence());
+  {
+    Journal<BookMsg> journal(journal_path);
+    Book restarted;
+    restarted.load_snapshot(restart_path);
+    restarted.set_journal(&journal);
+    restarted.add_order(5, 99, 7, true, fills);
+    journal.close();
+    // output: 7
+    std::cout << restarted.journal_sequence() << "\n";
+  }
+  Book rebuilt;
+  auto snapshot_seq = rebuilt.load_snapshot(restart_path);
+  auto tail_seq = rebuilt.recover(journal_path, snapshot_seq.value_or(0));
+  // output: 6 7 3 orders
+  std::cout << snapshot_seq.value_or(0) << " " << tail_seq.value_or(0) << " "
+            << rebuilt.size() << " orders\n";
+
+  // a journal that was opened but never written to is zero records
+  ::unlink(journal_path);
+  Journal<BookMsg>(journal_path).close();
+  Book fresh;
+  // output: 0
+  std::cout << fresh.recover(journal_path).value_or(99) << "\n";
+
+  // a crash mid-write leaves a torn record at the end. reopening the journal
+  // cuts it off, so what's appended after the restart still lines up
+  ::unlink(journal_path);
+  {
+    Journal<BookMsg> journal(journal_path);
+    Book live;
+    live.set_journal(&journal);
+    live.add_order(1, 100, 10, true, fills);
+    live.add_order(2, 101, 5, false, fills);
+    journal.close();
+  }
+  {
+    std::ofstream torn(journal_path, std::ios::binary | std::ios::app);
+    torn.write("torn record", 11);
+  }
+  {
+    Journal<BookMsg> journal(journal_path);
+    Book restarted;
+    restarted.recover(journal_path);
+    restarted.set_journal(&journal);
+    restarted.add_order(3, 99, 7, true, fills);
+    restarted.delete_order(2);
+    journal.close();
+  }
+  Book untorn;
+  auto untorn_seq = untorn.recover(journal_path);
+  // output: 4 2 orders
+  std::cout << untorn_seq.value_or(0) << " " << untorn.size() << " orders\n";
+
   return 0;
 }
@@ -0,0 +1,297 @@
+#pragma once
+
+#include "log_histogram.hpp"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <concepts>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// benchmark harness shared by the order book programs:
+//
+//   MODE=release ./run.sh order_book bench ops=1000000 cancel=0.4 modify=0.2
+//   MODE=release ./run.sh order_book_2 bench ops=1000000 cancel=0.4 modify=0.2
+//
+// (without MODE=release the default flags turn on the debug containers)
+//
+// both runs generate the exact same synthetic flow from the seed, so their
+// reports can be compared line by line. each program plugs its book in through
+// a small adapter satisfying BenchBook below
+
+struct BenchConfig {
+  size_t ops = 1'000'000; // timed operations, after the book is prefilled
+  double cancel_ratio = 0.4;
+  double modify_ratio = 0.2;
+  size_t depth = 10'000; // resting orders we try to keep in the book
+  size_t levels = 200;   // price levels per side that orders land on
+  double modify_reprice = 0.2; // fraction of modifies that change price
+  uint64_t mid = 100'000;
+  uint64_t seed = 42;
+};
+
+// a whole non negative decimal number, eg a command line count. nullopt for
+// anything else (empty, a sign, trailing junk, out of range), where std::stoul
+// would throw or quietly stop at the first non digit
+inline std::optional<size_t> parse_count(std::string_view arg) {
+  size_t value = 0;
+  const char* last = arg.data() + arg.size();
+  auto [end, error] = std::from_chars(arg.data(), last, value);
+  if (arg.empty() || error != std::errc() || end != last)
+    return std::nullopt;
+  return value;
+}
+
+// a ratio between 0 and 1 inclusive, nullopt for anything else
+inline std::optional<double> parse_ratio(std::string_view arg) {
+  double value = 0;
+  const char* last = arg.data() + arg.size();
+  auto [end, error] = std::from_chars(arg.data(), last, value);
+  if (arg.empty() || error != std::errc() || end != last || !(value >= 0) ||
+      value > 1)
+    return std::nullopt;
+  return value;
+}
+
+// what parse_bench_args understands, for the programs' usage messages
+inline constexpr std::string_view bench_options =
+    "[ops=N] [cancel=R] [modify=R] [depth=N] [levels=N] [reprice=R] [seed=N]";
+
+// key=value pairs, eg `ops=500000 cancel=0.5 depth=2000`. counts are whole
+// numbers and ratios are within [0, 1]. an unknown key or a bad value is
+// reported, and the result is nullopt
+inline std::optional<BenchConfig> parse_bench_args(std::span<char*> args) {
+  BenchConfig config;
+  for (std::string_view arg : args) {
+    auto eq = arg.find('=');
+    auto key = arg.substr(0, eq);
+    auto value = eq == arg.npos ? std::string_view() : arg.substr(eq + 1);
+    bool ok = false;
+    auto count = [&](auto& field) {
+      auto parsed = parse_count(value);
+      if ((ok = parsed.has_value()))
+        field = *parsed;
+    };
+    auto ratio = [&](double& field) {
+      auto parsed = parse_ratio(value);
+      if ((ok = parsed.has_value()))
+        field = *parsed;
+    };
+    if (key == "ops") {
+      count(config.ops);
+    } else if (key == "cancel") {
+      ratio(config.cancel_ratio);
+    } else if (key == "modify") {
+      ratio(config.modify_ratio);
+    } else if (key == "depth") {
+      count(config.depth);
+    } else if (key == "levels") {
+      count(config.levels);
+      config.levels = std::max<size_t>(1, config.levels);
+    } else if (key == "reprice") {
+      ratio(config.modify_reprice);
+    } else if (key == "seed") {
+      count(config.seed);
+    }
+    if (!ok) {
+      std::cerr << "bad bench option " << arg << "\n";
+      return std::nullopt;
+    }
+  }
+  return config;
+}
+
+enum class BenchOpType : uint8_t { Add, Delete, Modify };
+
+struct BenchOp {
+  BenchOpType type;
+  bool is_bid;
+  uint64_t id;
+  uint64_t price;
+  uint64_t qty;
+};
+
+// the flow is generated up front so that the rng isn't part of the timings.
+// prices are distributed exponentially away from the touch (most activity near
+// the top of the book), bids strictly below mid and asks at or above it, so no
+// order ever crosses and books with and without matching end up identical
+inline std::vector<BenchOp> generate_flow(const BenchConfig& config) {
+  std::mt19937_64 rng(config.seed);
+  std::uniform_real_distribution<double> coin(0.0, 1.0);
+  std::exponential_distribution<double> distance(
+      4.0 / static_cast<double>(config.levels));
+  std::uniform_int_distribution<uint64_t> qty(1, 1000);
+
+  auto price_for = [&](bool is_bid) {
+    auto ticks = std::min<uint64_t>(static_cast<uint64_t>(distance(rng)),
+                                    config.levels - 1);
+    return is_bid ? config.mid - 1 - ticks : config.mid + ticks;
+  };
+
+  struct Live {
+    uint64_t id;
+    bool is_bid;
+    uint64_t price;
+  };
+  std::vector<Live> live;
+  live.reserve(config.depth * 2 + 1);
+
+  std::vector<BenchOp> flow;
+  flow.reserve(config.depth + config.ops);
+  uint64_t next_id = 1;
+
+  auto add = [&] {
+    bool is_bid = coin(rng) < 0.5;
+    auto price = price_for(is_bid);
+    flow.push_back(BenchOp{BenchOpType::Add, is_bid, next_id, price, qty(rng)});
+    live.push_back(Live{next_id++, is_bid, price});
+  };
+
+  for (size_t i = 0; i < config.depth; ++i) {
+    add();
+  }
+
+  for (size_t i = 0; i < config.ops; ++i) {
+    auto r = coin(rng);
+    if (live.size() < config.depth / 2 + 1 ||
+        (r >= config.cancel_ratio + config.modify_ratio &&
+         live.size() < config.depth * 2)) {
+      add();
+      continue;
+    }
+
+    auto pick = std::uniform_int_distribution<size_t>(0, live.size() - 1)(rng);
+    auto& order = live[pick];
+    if (r < config.cancel_ratio ||
+        r >= config.cancel_ratio + config.modify_ratio) {
+      flow.push_back(
+          BenchOp{BenchOpType::Delete, order.is_bid, order.id, 0, 0});
+      order = live.back();
+      live.pop_back();
+    } else {
+      if (coin(rng) < config.modify_reprice)
+        order.price = price_for(order.is_bid);
+      flow.push_back(BenchOp{BenchOpType::Modify, order.is_bid, order.id,
+                             order.price, qty(rng)});
+    }
+  }
+  return flow;
+}
+
+// hdr style histogram: exact below 128, then 64 linear sub buckets per power
+// of two, so every recorded value is kept to within ~1.6% regardless of
+// magnitude, in a fixed ~30KB
+class HdrHistogram {
+public:
+  void record(uint64_t value) noexcept {
+    ++counts[Buckets::index_of(value)];
+    ++total;
+    max = std::max(max, value);
+  }
+
+  [[nodiscard]] uint64_t count() const noexcept { return total; }
+
+  // smallest bucket value such that at least p of the samples are <= it
+  [[nodiscard]] uint64_t percentile(double p) const noexcept {
+    return Buckets::percentile(counts, total, max, p);
+  }
+
+  [[nodiscard]] uint64_t maximum() const noexcept { return max; }
+
+  void merge(const HdrHistogram& other) noexcept {
+    for (size_t i = 0; i < counts.size(); ++i)
+      counts[i] += other.counts[i];
+    total += other.total;
+    max = std::max(max, other.max);
+  }
+
+private:
+  using Buckets = LogLinearBuckets<6>;
+
+  std::array<uint64_t, Buckets::count> counts{};
+  uint64_t total = 0;
+  uint64_t max = 0;
+};
+
+// the common interface every book is driven through. modify always carries
+// the order's price, which is only different from before on a reprice
+template <typename B>
+concept BenchBook = requires(B book, uint64_t id, bool is_bid, uint64_t price,
+                             uint64_t qty) {
+  book.add(id, is_bid, price, qty);
+  book.remove(id);
+  book.modify(id, price, qty);
+};
+
+inline void print_latency_row(std::string_view op, const HdrHistogram& hist) {
+  std::cout << std::left << std::setw(8) << op << std::right << std::setw(10)
+            << hist.count() << std::setw(8) << hist.percentile(0.5)
+            << std::setw(8) << hist.percentile(0.99) << std::setw(8)
+            << hist.percentile(0.999) << std::setw(10) << hist.maximum()
+            << "\n";
+}
+
+template <BenchBook B>
+int run_bench(std::string_view name, B& book, const BenchConfig& config) {
+  auto flow = generate_flow(config);
+  auto prefill = std::span(flow).first(config.depth);
+  auto timed = std::span(flow).subspan(config.depth);
+
+  auto apply = [&book](const BenchOp& op) {
+    switch (op.type) {
+      case BenchOpType::Add:
+        book.add(op.id, op.is_bid, op.price, op.qty);
+        break;
+      case BenchOpType::Delete:
+        book.remove(op.id);
+        break;
+      case BenchOpType::Modify:
+        book.modify(op.id, op.price, op.qty);
+        break;
+    }
+  };
+
+  for (const auto& op : prefill)
+    apply(op);
+
+  std::array<HdrHistogram, 3> latency{};
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  for (const auto& op : timed) {
+    auto before = clock::now();
+    apply(op);
+    auto elapsed = clock::now() - before;
+    latency[static_cast<size_t>(op.type)].record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+  }
+  auto seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+  HdrHistogram all;
+  for (const auto& hist : latency)
+    all.merge(hist);
+
+  std::cout << name << ": " << timed.size() << " ops (cancel "
+            << config.cancel_ratio << ", modify " << config.modify_ratio
+            << ", depth " << config.depth << ", levels " << config.levels
+            << ", seed " << config.seed << ")\n"
+            << "throughput: " << static_cast<double>(timed.size()) / seconds
+            << " ops/s (includes clock overhead)\n"
+            << std::left << std::setw(8) << "op" << std::right << std::setw(10)
+            << "count" << std::setw(8) << "p50" << std::setw(8) << "p99"
+            << std::setw(8) << "p99.9" << std::setw(10) << "max ns"
+            << "\n";
+  print_latency_row("add", latency[0]);
+  print_latency_row("delete", latency[1]);
+  print_latency_row("modify", latency[2]);
+  print_latency_row("all", all);
+  return 0;
+}
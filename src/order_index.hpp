@@ -0,0 +1,344 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// flat replacement for std::unordered_map<OrderId, Value> on the order id ->
+// order lookup path. two parts:
+//
+// 1. a direct indexed window. exchanges usually hand out order ids that are
+//    dense and increasing, so the ids that are alive at any point sit in a
+//    narrow range. the window is a power of two array covering
+//    [base, base + size), indexed by id & mask with an occupancy bitmap. when a
+//    new id lands just past the top we slide the window up, and any orders
+//    still alive below the new base get moved into the hash table
+//
+// 2. a robin hood hash table for everything else (ids below the window, or
+//    ids far away from it). deletion uses backward shifting instead of
+//    tombstones, so probe lengths don't degrade over a long session
+//
+// ids that went to the table can later end up inside the window's range (an
+// id far past the top, once the window slides up to it), so a window miss
+// still has to check the table. we track the largest id in the table so that
+// the common case, a new id above everything in the table, skips it
+//
+// the window is allocated (and zeroed) up front, twice the capacity hint but
+// capped at max_window slots: it only has to span the ids alive at once, not
+// everything a long feed will ever hand out. the table starts empty and grows
+// as ids spill into it, so a generous hint costs nothing there
+//
+// pointers returned by find() are invalidated by the next insert
+
+template <typename Value>
+class FlatOrderIndex {
+public:
+  static constexpr size_t max_window = size_t{1} << 19;
+
+  explicit FlatOrderIndex(size_t capacity_hint = 1024)
+      : window(std::bit_ceil(std::clamp<size_t>(capacity_hint * 2, 64,
+                                                max_window))),
+        occupied(window.size() / 64, 0), window_mask(window.size() - 1) {}
+
+  [[nodiscard]] Value* find(uint64_t id) noexcept {
+    if (in_window(id) && test(id)) {
+      return &window[id & window_mask];
+    }
+    return maybe_in_table(id) ? table_find(id) : nullptr;
+  }
+
+  [[nodiscard]] const Value* find(uint64_t id) const noexcept {
+    return const_cast<FlatOrderIndex*>(this)->find(id);
+  }
+
+  [[nodiscard]] bool contains(uint64_t id) const noexcept {
+    return find(id) != nullptr;
+  }
+
+  // pulls in the cache lines a find(id) is going to touch: the window slot and
+  // its bitmap word, or the id's home slot in the table
+  void prefetch(uint64_t id) const noexcept {
+    if (in_window(id)) {
+      auto slot = id & window_mask;
+      __builtin_prefetch(&window[slot]);
+      __builtin_prefetch(&occupied[slot / 64]);
+    } else if (table_count != 0) {
+      __builtin_prefetch(&slots[home(id)]);
+    }
+  }
+
+  // number of table slots a find(id) looks at, 0 when the window answers it or
+  // the table can be skipped. for instrumentation, see book_stats.hpp
+  [[nodiscard]] uint32_t probe_length(uint64_t id) const noexcept {
+    if ((in_window(id) && test(id)) || !maybe_in_table(id)) {
+      return 0;
+    }
+
+    auto mask = slots.size() - 1;
+    auto idx = home(id);
+    for (uint32_t dist = 1;; ++dist, idx = (idx + 1) & mask) {
+      const auto& slot = slots[idx];
+      if (slot.dist < dist || slot.id == id) {
+        return dist;
+      }
+    }
+  }
+
+  // returns false (and leaves the existing entry alone) if id is present
+  bool insert(uint64_t id, const Value& value) {
+    if (!in_window(id) && !slide_window(id)) {
+      return table_insert(id, value);
+    }
+
+    if (test(id) || (maybe_in_table(id) && table_find(id))) {
+      return false;
+    }
+    window[id & window_mask] = value;
+    set(id);
+    ++window_count;
+    return true;
+  }
+
+  bool erase(uint64_t id) noexcept {
+    if (in_window(id) && test(id)) {
+      clear(id);
+      --window_count;
+      return true;
+    }
+    return maybe_in_table(id) && table_erase(id);
+  }
+
+  [[nodiscard]] size_t size() const noexcept {
+    return window_count + table_count;
+  }
+
+  // sizes the hash table so that n entries fit without a rehash
+  void reserve(size_t n) {
+    auto wanted = std::bit_ceil(std::max<size_t>(16, n + n / 4 + 1));
+    if (wanted > slots.size()) {
+      rehash(wanted);
+    }
+  }
+
+private:
+  // ---- direct window ----
+
+  [[nodiscard]] bool in_window(uint64_t id) const noexcept {
+    return id >= base && id - base < window.size();
+  }
+
+  [[nodiscard]] bool test(uint64_t id) const noexcept {
+    auto slot = id & window_mask;
+    return (occupied[slot / 64] >> (slot % 64)) & 1;
+  }
+
+  void set(uint64_t id) noexcept {
+    auto slot = id & window_mask;
+    occupied[slot / 64] |= uint64_t{1} << (slot % 64);
+  }
+
+  void clear(uint64_t id) noexcept {
+    auto slot = id & window_mask;
+    occupied[slot / 64] &= ~(uint64_t{1} << (slot % 64));
+  }
+
+  // tries to move the window up so that id becomes its top slot. ids below the
+  // window, or more than a whole window past the top, go to the hash table
+  // instead (unless the window is empty, in which case we just jump)
+  bool slide_window(uint64_t id) {
+    if (window_count == 0 && id >= base) {
+      base = id;
+      return true;
+    }
+    if (id < base || id - base >= 2 * window.size()) {
+      return false;
+    }
+
+    // whatever is alive in [base, new_base) moves to the table. the bitmap is
+    // walked a word at a time and only its set bits are visited, so a slide
+    // over sparse ids costs a word per 64 ids rather than a test per id
+    auto new_base = id - window.size() + 1;
+    for (auto pos = base; pos < new_base && window_count != 0;) {
+      auto slot = pos & window_mask;
+      auto span = std::min<uint64_t>(64 - slot % 64, new_base - pos);
+      auto bits = occupied[slot / 64] >> (slot % 64);
+      if (span < 64) {
+        bits &= (uint64_t{1} << span) - 1;
+      }
+      for (; bits != 0; bits &= bits - 1) {
+        auto old = pos + static_cast<uint64_t>(std::countr_zero(bits));
+        table_insert(old, window[old & window_mask]);
+        clear(old);
+        --window_count;
+      }
+      pos += span;
+    }
+    base = new_base;
+    return true;
+  }
+
+  // ---- robin hood table ----
+
+  // dist is the probe distance + 1, so zero marks an empty slot
+  struct Slot {
+    uint64_t id;
+    Value value;
+    uint32_t dist;
+  };
+
+  // splitmix64 finalizer, sequential ids would otherwise cluster
+  [[nodiscard]] static uint64_t hash(uint64_t id) noexcept {
+    id ^= id >> 30;
+    id *= 0xbf58476d1ce4e5b9ull;
+    id ^= id >> 27;
+    id *= 0x94d049bb133111ebull;
+    id ^= id >> 31;
+    return id;
+  }
+
+  [[nodiscard]] size_t home(uint64_t id) const noexcept {
+    return static_cast<size_t>(hash(id)) & (slots.size() - 1);
+  }
+
+  // slot index of id, or slots.size() if it isn't there
+  [[nodiscard]] size_t table_index(uint64_t id) const noexcept {
+    if (table_count == 0) {
+      return slots.size();
+    }
+
+    auto mask = slots.size() - 1;
+    auto idx = home(id);
+    for (uint32_t dist = 1;; ++dist, idx = (idx + 1) & mask) {
+      const auto& slot = slots[idx];
+      // robin hood: once we're further from home than the resident, the id
+      // can't be further along
+      if (slot.dist < dist) {
+        return slots.size();
+      }
+      if (slot.id == id) {
+        return idx;
+      }
+    }
+  }
+
+  [[nodiscard]] bool maybe_in_table(uint64_t id) const noexcept {
+    return table_count != 0 && id <= table_max;
+  }
+
+  [[nodiscard]] Value* table_find(uint64_t id) noexcept {
+    auto idx = table_index(id);
+    return idx == slots.size() ? nullptr : &slots[idx].value;
+  }
+
+  bool table_insert(uint64_t id, const Value& value) {
+    // max load factor 7/8
+    if ((table_count + 1) * 8 > slots.size() * 7) {
+      rehash(std::max<size_t>(16, slots.size() * 2));
+    }
+
+    auto mask = slots.size() - 1;
+    auto idx = home(id);
+    Slot incoming{id, value, 1};
+    bool displaced = false;
+    for (;; ++incoming.dist, idx = (idx + 1) & mask) {
+      auto& slot = slots[idx];
+      if (slot.dist == 0) {
+        slot = incoming;
+        ++table_count;
+        table_max = std::max(table_max, id);
+        return true;
+      }
+      if (!displaced && slot.dist == incoming.dist && slot.id == id) {
+        return false;
+      }
+      if (slot.dist < incoming.dist) {
+        std::swap(slot, incoming);
+        displaced = true;
+      }
+    }
+  }
+
+  bool table_erase(uint64_t id) noexcept {
+    auto idx = table_index(id);
+    if (idx == slots.size()) {
+      return false;
+    }
+
+    // shift every following entry that isn't in its home slot back by one
+    auto mask = slots.size() - 1;
+    for (auto next = (idx + 1) & mask; slots[next].dist > 1;
+         idx = next, next = (next + 1) & mask) {
+      slots[idx] = slots[next];
+      --slots[idx].dist;
+    }
+    slots[idx].dist = 0;
+    if (--table_count == 0) {
+      table_max = 0;
+    }
+    return true;
+  }
+
+  void rehash(size_t new_size) {
+    auto old = std::exchange(slots, std::vector<Slot>(new_size));
+    table_count = 0;
+    table_max = 0;
+    for (const auto& slot : old) {
+      if (slot.dist != 0) {
+        table_insert(slot.id, slot.value);
+      }
+    }
+  }
+
+  uint64_t base = 0;
+  size_t window_count = 0;
+  std::vector<Value> window;
+  std::vector<uint64_t> occupied;
+  uint64_t window_mask;
+
+  size_t table_count = 0;
+  uint64_t table_max = 0; // upper bound on the ids in the table
+  std::vector<Slot> slots;
+};
+
+// the plain std::unordered_map this replaced, behind the same interface, so
+// the two can be swapped (see basic_order_book.hpp). pointers returned by
+// find() stay valid until that id is erased
+template <typename Value>
+class HashOrderIndex {
+public:
+  explicit HashOrderIndex(size_t capacity_hint = 1024) {
+    map.reserve(capacity_hint);
+  }
+
+  [[nodiscard]] Value* find(uint64_t id) noexcept {
+    auto it = map.find(id);
+    return it == map.end() ? nullptr : &it->second;
+  }
+
+  [[nodiscard]] const Value* find(uint64_t id) const noexcept {
+    return const_cast<HashOrderIndex*>(this)->find(id);
+  }
+
+  [[nodiscard]] bool contains(uint64_t id) const noexcept {
+    return map.contains(id);
+  }
+
+  // the node hangs off a bucket chain, nothing useful to pull in ahead of time
+  void prefetch(uint64_t /*id*/) const noexcept {}
+
+  bool insert(uint64_t id, const Value& value) {
+    return map.try_emplace(id, value).second;
+  }
+
+  bool erase(uint64_t id) noexcept { return map.erase(id) != 0; }
+
+  [[nodiscard]] size_t size() const noexcept { return map.size(); }
+
+  void reserve(size_t n) { map.reserve(n); }
+
+private:
+  std::unordered_map<uint64_t, Value> map;
+};
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <vector>
+
+// a dense side container for an order book. most symbols trade inside a narrow
+// band of ticks, so instead of a red-black tree we keep a flat array of levels
+// indexed by (price - base) / tick and a two level occupancy bitmap on top:
+//
+// - words: one bit per tick, set when that level is non-empty
+// - summary: one bit per word, set when that word is non-zero
+//
+// best bid / best ask / next level are then a couple of countl_zero /
+// countr_zero instructions rather than a tree walk
+//
+// prices that fall outside the window (or off the tick grid) go into a
+// std::map fallback. when the whole window is empty we recenter it around the
+// incoming price instead, as long as that doesn't overlap a fallback level.
+// levels never move once created, so pointers to them stay valid until erased
+
+template <typename Price, typename Level>
+class PriceLadder {
+public:
+  explicit PriceLadder(Price tick_size = 1, size_t num_ticks = 4096)
+      : tick(tick_size), levels(round_up(num_ticks)),
+        words(levels.size() / 64, 0),
+        summary((words.size() + 63) / 64, 0) {}
+
+  [[nodiscard]] Level* find(Price price) noexcept {
+    if (auto idx = index_of(price)) {
+      return test(*idx) ? &levels[*idx] : nullptr;
+    }
+    auto it = overflow.find(price);
+    return it == overflow.end() ? nullptr : &it->second;
+  }
+
+  [[nodiscard]] const Level* find(Price price) const noexcept {
+    return const_cast<PriceLadder*>(this)->find(price);
+  }
+
+  // pulls in the level and its bitmap word ahead of a find / emplace. prices in
+  // the fallback tree aren't worth chasing
+  void prefetch(Price price) const noexcept {
+    if (auto idx = index_of(price)) {
+      __builtin_prefetch(&levels[*idx]);
+      __builtin_prefetch(&words[*idx / 64]);
+    }
+  }
+
+  // returns the level at price, creating an empty one if needed
+  Level& emplace(Price price) {
+    if (window_count == 0 && !index_of(price)) {
+      recenter(price);
+    }
+
+    if (auto idx = index_of(price)) {
+      if (!test(*idx)) {
+        set(*idx);
+        ++window_count;
+      }
+      return levels[*idx];
+    }
+    return overflow[price];
+  }
+
+  void erase(Price price) {
+    if (auto idx = index_of(price)) {
+      if (test(*idx)) {
+        levels[*idx] = Level{};
+        clear(*idx);
+        --window_count;
+      }
+      return;
+    }
+    overflow.erase(price);
+  }
+
+  [[nodiscard]] bool empty() const noexcept {
+    return window_count == 0 && overflow.empty();
+  }
+
+  [[nodiscard]] size_t size() const noexcept {
+    return window_count + overflow.size();
+  }
+
+  [[nodiscard]] std::optional<Price> highest() const noexcept {
+    std::optional<Price> best;
+    if (!overflow.empty()) {
+      best = overflow.rbegin()->first;
+    }
+    if (auto idx = prev_set(levels.size())) {
+      best = best ? std::max(*best, price_of(*idx)) : price_of(*idx);
+    }
+    return best;
+  }
+
+  [[nodiscard]] std::optional<Price> lowest() const noexcept {
+    std::optional<Price> best;
+    if (!overflow.empty()) {
+      best = overflow.begin()->first;
+    }
+    if (auto idx = next_set(0)) {
+      best = best ? std::min(*best, price_of(*idx)) : price_of(*idx);
+    }
+    return best;
+  }
+
+  // highest non-empty level strictly below price
+  [[nodiscard]] std::optional<Price> next_lower(Price price) const noexcept {
+    std::optional<Price> best;
+    auto it = overflow.lower_bound(price);
+    if (it != overflow.begin()) {
+      best = std::prev(it)->first;
+    }
+    if (price > base) {
+      // first window slot whose price is >= price, everything before it is
+      // strictly lower
+      auto bound = std::min<size_t>(
+          static_cast<size_t>((price - base + tick - 1) / tick),
+          levels.size());
+      if (auto idx = prev_set(bound)) {
+        best = best ? std::max(*best, price_of(*idx)) : price_of(*idx);
+      }
+    }
+    return best;
+  }
+
+  // lowest non-empty level strictly above price
+  [[nodiscard]] std::optional<Price> next_higher(Price price) const noexcept {
+    std::optional<Price> best;
+    auto it = overflow.upper_bound(price);
+    if (it != overflow.end()) {
+      best = it->first;
+    }
+    size_t from =
+        price < base ? 0 : static_cast<size_t>((price - base) / tick) + 1;
+    if (auto idx = next_set(from)) {
+      best = best ? std::min(*best, price_of(*idx)) : price_of(*idx);
+    }
+    return best;
+  }
+
+private:
+  static size_t round_up(size_t n) { return n == 0 ? 64 : (n + 63) / 64 * 64; }
+
+  [[nodiscard]] std::optional<size_t> index_of(Price price) const noexcept {
+    if (price < base || (price - base) % tick != 0) {
+      return std::nullopt;
+    }
+    auto idx = (price - base) / tick;
+    if (idx >= levels.size()) {
+      return std::nullopt;
+    }
+    return static_cast<size_t>(idx);
+  }
+
+  [[nodiscard]] Price price_of(size_t idx) const noexcept {
+    return static_cast<Price>(base + static_cast<Price>(idx) * tick);
+  }
+
+  // only called with an empty window. centers the window on price while
+  // keeping it on the same tick grid, unless a fallback level would end up
+  // inside it
+  void recenter(Price price) {
+    auto half = static_cast<Price>(levels.size() / 2) * tick;
+    auto new_base = price >= half ? static_cast<Price>(price - half)
+                                  : static_cast<Price>(price % tick);
+    auto span = static_cast<Price>(levels.size()) * tick;
+    auto it = overflow.lower_bound(new_base);
+    if (it != overflow.end() && it->first - new_base < span) {
+      return;
+    }
+    base = new_base;
+  }
+
+  [[nodiscard]] bool test(size_t idx) const noexcept {
+    return (words[idx / 64] >> (idx % 64)) & 1;
+  }
+
+  void set(size_t idx) noexcept {
+    words[idx / 64] |= uint64_t{1} << (idx % 64);
+    summary[idx / 4096] |= uint64_t{1} << (idx / 64 % 64);
+  }
+
+  void clear(size_t idx) noexcept {
+    words[idx / 64] &= ~(uint64_t{1} << (idx % 64));
+    if (words[idx / 64] == 0) {
+      summary[idx / 4096] &= ~(uint64_t{1} << (idx / 64 % 64));
+    }
+  }
+
+  // smallest set index >= idx
+  [[nodiscard]] std::optional<size_t> next_set(size_t idx) const noexcept {
+    if (idx >= levels.size()) {
+      return std::nullopt;
+    }
+
+    auto w = idx / 64;
+    auto bits = words[w] & (~uint64_t{0} << (idx % 64));
+    if (bits) {
+      return w * 64 + static_cast<size_t>(std::countr_zero(bits));
+    }
+
+    auto s = w / 64;
+    auto sbits =
+        w % 64 == 63 ? 0 : summary[s] & (~uint64_t{0} << (w % 64 + 1));
+    while (!sbits) {
+      if (++s == summary.size()) {
+        return std::nullopt;
+      }
+      sbits = summary[s];
+    }
+    w = s * 64 + static_cast<size_t>(std::countr_zero(sbits));
+    return w * 64 + static_cast<size_t>(std::countr_zero(words[w]));
+  }
+
+  // largest set index < idx
+  [[nodiscard]] std::optional<size_t> prev_set(size_t idx) const noexcept {
+    if (idx == 0) {
+      return std::nullopt;
+    }
+
+    --idx;
+    auto w = idx / 64;
+    auto b = idx % 64;
+    auto bits =
+        words[w] & (b == 63 ? ~uint64_t{0} : (uint64_t{1} << (b + 1)) - 1);
+    if (bits) {
+      return w * 64 + 63 - static_cast<size_t>(std::countl_zero(bits));
+    }
+
+    auto s = w / 64;
+    auto sbits = summary[s] & ((uint64_t{1} << (w % 64)) - 1);
+    while (!sbits) {
+      if (s-- == 0) {
+        return std::nullopt;
+      }
+      sbits = summary[s];
+    }
+    w = s * 64 + 63 - static_cast<size_t>(std::countl_zero(sbits));
+    return w * 64 + 63 - static_cast<size_t>(std::countl_zero(words[w]));
+  }
+
+  Price base = 0;
+  Price tick;
+  size_t window_count = 0;
+
+  std::vector<Level> levels;
+  std::vector<uint64_t> words;
+  std::vector<uint64_t> summary;
+
+  std::map<Price, Level> overflow;
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// single writer, any number of readers. the writer never waits: it bumps the
+// sequence to odd, writes, and bumps it back to even. a reader copies the
+// value out and retries if the sequence was odd or moved underneath it, so a
+// read only repeats when it overlapped a store
+//
+// the payload is held as relaxed atomic words rather than a plain T, so the
+// racing copy a reader makes is well defined. T just has to be trivially
+// copyable
+
+template <typename T>
+class Seqlock {
+  static_assert(std::is_trivially_copyable_v<T>);
+  static_assert(std::is_default_constructible_v<T>);
+
+public:
+  Seqlock() = default;
+
+  // readers on other threads point at us
+  Seqlock(const Seqlock& other) = delete;
+  Seqlock& operator=(const Seqlock& other) = delete;
+
+  // writer thread only
+  void store(const T& value) noexcept {
+    std::array<uint64_t, num_words> words{};
+    std::memcpy(words.data(), &value, sizeof(T));
+
+    auto seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < num_words; ++i)
+      data[i].store(words[i], std::memory_order_relaxed);
+    sequence.store(seq + 2, std::memory_order_release);
+  }
+
+  // any thread. spins (with a pause) only while a store is in flight
+  [[nodiscard]] T load() const noexcept {
+    std::array<uint64_t, num_words> words;
+    for (;;) {
+      auto before = sequence.load(std::memory_order_acquire);
+      if (before & 1) {
+        pause();
+        continue;
+      }
+      for (size_t i = 0; i < num_words; ++i)
+        words[i] = data[i].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence.load(std::memory_order_relaxed) == before)
+        break;
+    }
+
+    T value;
+    std::memcpy(static_cast<void*>(&value), words.data(), sizeof(T));
+    return value;
+  }
+
+  // number of completed stores, lets a reader skip a copy when nothing changed
+  [[nodiscard]] uint64_t version() const noexcept {
+    return sequence.load(std::memory_order_acquire) / 2;
+  }
+
+private:
+  static constexpr size_t num_words = (sizeof(T) + 7) / 8;
+
+  static void pause() noexcept {
+#if defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+  }
+
+  // start on a fresh cache line, so readers polling the sequence don't false
+  // share with whatever the writer keeps next to us
+  alignas(64) std::atomic<uint64_t> sequence{0};
+  std::array<std::atomic<uint64_t>, num_words> data{};
+};
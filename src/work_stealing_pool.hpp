@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// runs a fixed batch of independent tasks on every core. each worker has its
+// own deque: it takes work from the front of its own, and when that runs dry
+// steals from the back of someone else's. tasks that turn out to be slow just
+// mean the other workers take over the rest of that worker's queue, which a
+// static split of the tasks can't do
+//
+// the tasks here are big (a whole file each), so a deque behind a mutex per
+// worker is plenty. the locks are only ever contended while stealing
+//
+// no tasks are added while a batch runs, so a worker that finds every deque
+// empty is done
+
+class WorkStealingPool {
+public:
+  explicit WorkStealingPool(size_t num_threads = default_threads())
+      : queues(std::max<size_t>(num_threads, 1)) {}
+
+  // the queues hold locks that the workers point at
+  WorkStealingPool(const WorkStealingPool& other) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool& other) = delete;
+
+  [[nodiscard]] size_t size() const noexcept { return queues.size(); }
+
+  // calls f(task, worker) once for every task in [0, num_tasks) and returns
+  // when they have all finished. worker is in [0, size()), so f can keep per
+  // worker scratch space without locking. tasks are dealt round robin in
+  // index order and each worker starts from the front of its share, so
+  // sorting the tasks biggest first gets the big ones going first
+  template <typename F>
+  void run(size_t num_tasks, F&& f) {
+    for (size_t task = 0; task < num_tasks; ++task)
+      queues[task % queues.size()].tasks.push_back(task);
+
+    auto work = [this, &f](size_t self) {
+      for (;;) {
+        auto task = queues[self].pop_front();
+        if (!task)
+          task = steal(self);
+        if (!task)
+          return;
+        f(*task, self);
+      }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < queues.size(); ++i)
+      workers.emplace_back(work, i);
+    work(0);
+    for (auto& worker : workers)
+      worker.join();
+  }
+
+  // tasks a worker took from another worker's queue, over every run so far
+  [[nodiscard]] uint64_t steal_count() const noexcept {
+    return steals.load(std::memory_order_relaxed);
+  }
+
+  static size_t default_threads() noexcept {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+private:
+  // own line each, so one worker's lock traffic doesn't slow its neighbours
+  struct alignas(64) Queue {
+    std::mutex lock;
+    std::deque<size_t> tasks;
+
+    std::optional<size_t> pop_front() {
+      std::lock_guard guard(lock);
+      if (tasks.empty())
+        return std::nullopt;
+      auto task = tasks.front();
+      tasks.pop_front();
+      return task;
+    }
+
+    // thieves take the far end, the tasks the owner would have got to last
+    std::optional<size_t> pop_back() {
+      std::lock_guard guard(lock);
+      if (tasks.empty())
+        return std::nullopt;
+      auto task = tasks.back();
+      tasks.pop_back();
+      return task;
+    }
+  };
+
+  std::optional<size_t> steal(size_t self) {
+    for (size_t i = 1; i < queues.size(); ++i) {
+      if (auto task = queues[(self + i) % queues.size()].pop_back()) {
+        steals.fetch_add(1, std::memory_order_relaxed);
+        return task;
+      }
+    }
+    return std::nullopt;
+  }
+
+  std::vector<Queue> queues;
+  std::atomic<uint64_t> steals{0};
+};